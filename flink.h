@@ -16,7 +16,16 @@
 #include <linux/spinlock_types.h>
 #include <linux/mutex.h>
 #include <linux/list.h>
+#include <linux/hashtable.h>
 #include <linux/fs.h>
+#include <linux/cdev.h>
+#include <linux/kref.h>
+#include <linux/wait.h>
+#include <linux/workqueue.h>
+#include <linux/hrtimer.h>
+#include <linux/kfifo.h>
+#include <linux/cache.h>
+#include <linux/rcupdate.h>
 #include "flink_ioctl.h"
 
 // ################# Debugging #################
@@ -51,9 +60,36 @@ struct flink_device;
 struct flink_private_data {
 	struct flink_device*    fdev;
 	struct flink_subdevice* current_subdevice;
+	bool                    fixed_subdevice;	/// Opened through a subdevice node, the subdevice can't be changed
+	bool                    relaxed;			/// 32 bit accesses and bursts use relaxed ordering (SET_RELAXED)
+	bool                    write_behind;		/// Single register writes are queued (SET_WRITE_BEHIND)
+	int                     write_error;		/// First error of a queued write of this file, reported by FLUSH/fsync, protected by the write queue lock
+	struct flink_subdevice* excl_subdevice;		/// Subdevice owned exclusively by this file (SELECT_SUBDEVICE_EXCL)
+	bool                    bit_claims;			/// The file claimed bits of a register (CLAIM_BITS)
+	struct flink_program*   program;			/// Sequencer program of the file (LOAD_PROGRAM), protected by program_lock
+	struct mutex            program_lock;		/// Serializes loading, triggering and freeing the program
+	struct list_head        timed_writes;		/// Timed writes submitted by this file, protected by the timed write lock of the device
+	u32                     nof_timed_writes;	/// Number of entries in timed_writes
+	bool                    irq_eventfds;		/// The file bound eventfds to IRQs (BIND_IRQ_EVENTFD)
+	struct flink_event_queue* events;			/// IRQ events of subscribed IRQs, NULL if the file is not in event mode, published with smp_store_release()
+	struct mutex            events_lock;		/// Serializes creating the event queue
 };
 
 // ############ flink bus operations ############
+// Capabilities of a bus (flink_bus_ops.caps)
+#define FLINK_CAP_8BIT			(1 << 0)	// 8 bit accesses
+#define FLINK_CAP_16BIT			(1 << 1)	// 16 bit accesses
+#define FLINK_CAP_32BIT			(1 << 2)	// 32 bit accesses
+#define FLINK_CAP_BURST			(1 << 3)	// block transfers are faster than single accesses
+#define FLINK_CAP_RELAXED		(1 << 4)	// accesses may use relaxed ordering (memory mapped buses)
+#define FLINK_CAP_MMAP			(1 << 5)	// registers can be mapped to user space
+#define FLINK_CAP_ATOMIC		(1 << 6)	// accesses never sleep and may be called in hard interrupt context
+
+// Modes of block transfers
+#define FLINK_BLOCK_INCREMENT	0			// consecutive 32 bit registers
+#define FLINK_BLOCK_FIXED		(1 << 0)	// always the same register (e.g. a FIFO)
+#define FLINK_BLOCK_RELAXED		(1 << 1)	// no ordering barriers between the accesses
+
 /// @brief Functions to communicate with various bus communication modules
 struct flink_bus_ops {
 	u8  (*read8)(struct flink_device*, u32 addr);			/// read 1 byte
@@ -63,14 +99,118 @@ struct flink_bus_ops {
 	int (*write16)(struct flink_device*, u32 addr, u16 val);	/// write 2 bytes
 	int (*write32)(struct flink_device*, u32 addr, u32 val);	/// write 4 bytes
 	u32 (*address_space_size)(struct flink_device*);		/// get address space size
+	phys_addr_t (*phys_address)(struct flink_device*);		/// get physical base address of a memory mapped bus (optional, enables mmap)
+	int (*read_block)(struct flink_device*, u32 addr, u32* buf, u32 count, u32 mode);	/// read count 32 bit registers (optional)
+	int (*write_block)(struct flink_device*, u32 addr, const u32* buf, u32 count, u32 mode);	/// write count 32 bit registers (optional)
+	u32 (*read32_relaxed)(struct flink_device*, u32 addr);		/// read 4 bytes without ordering barriers (optional)
+	int (*write32_relaxed)(struct flink_device*, u32 addr, u32 val);	/// write 4 bytes without ordering barriers (optional)
+	int (*flush)(struct flink_device*);					/// complete all previous accesses (optional)
+	u32 caps;							/// capabilities of the bus (FLINK_CAP_*), 0 if unknown
+};
+
+// ############ flink bit ownership ############
+/// @brief Shadow of a register whose bits are owned by several files (CLAIM_BITS)
+struct flink_shadow_register {
+	struct list_head list;			/// Entry in the shadow register list of the subdevice, RCU protected
+	struct list_head claims;		/// Claims of the files owning bits of this register
+	u32              offset;		/// Offset of the register within the subdevice
+	u32              value;			/// Last value written to the register through any write path
+	u32              claimed;		/// Bits claimed by any file
+	bool             stale;			/// A narrow or block write hit the register, value must be read back
+	struct rcu_head  rcu;			/// Deferred free after removal from the list
+};
+
+/// @brief Bits of a shadowed register owned by one file
+struct flink_bit_claim {
+	struct list_head           list;	/// Entry in the claim list of the shadow register
+	struct flink_private_data* owner;	/// The owning file
+	u32                        mask;	/// Owned bits
+};
+
+// ############ flink register cache ############
+/// @brief A cached 32 bit register
+struct flink_cached_register {
+	u32  value;			/// Last value read from or written to the register
+	bool cacheable;		/// Reads may be answered from the cache
+	bool valid;			/// value is up to date
+};
+
+/// @brief Register cache of a subdevice, covers the registers from offset 0 up to nof_registers
+struct flink_register_cache {
+	u32 nof_registers;	/// Number of 32 bit registers covered
+	u32 generation;		/// Incremented whenever registers are invalidated
+	struct flink_cached_register regs[];
+};
+
+// ############ flink timed writes ############
+#define MAX_TIMED_WRITES_PER_FILE	64
+/// @brief A register write executed at an absolute time
+struct flink_timed_write {
+	struct list_head        list;		/// Entry in the pending or executed list of the device
+	struct list_head        file_node;	/// Entry in the timed write list of the submitting file
+	struct flink_subdevice* subdev;		/// Subdevice containing the register
+	u32                     offset;		/// Offset of the register within the subdevice
+	u32                     value;		/// Value to write
+	u32                     generation;	/// Cache generation at submission, see flink_cache_generation()
+	u64                     id;			/// Identifies the write, returned to user space
+	ktime_t                 time;		/// Requested time (CLOCK_MONOTONIC)
+	ktime_t                 executed;	/// Time of the write (CLOCK_MONOTONIC)
+	u8                      clock;		/// Clock of the request (FLINK_CLOCK_*)
+	bool                    written;	/// The timer executed the write
+	bool                    done;		/// The write and its bookkeeping are completed
+};
+
+/// @brief Timed writes of a device, executed from a hard interrupt hrtimer
+struct flink_timed_writes {
+	raw_spinlock_t     lock;		/// Protects all lists and flags of the timed writes, taken by the timer
+	struct hrtimer     timer;		/// Expires at the time of the first pending write
+	struct list_head   pending;		/// Writes sorted by time
+	struct list_head   executed;	/// Written, waiting for the completion work
+	struct work_struct work;		/// Updates the register cache and wakes up waiters after writes
+	wait_queue_head_t  wait;		/// Woken up whenever writes completed
+	u64                next_id;		/// Id of the next submitted write
+};
+
+// ############ flink read coalescing ############
+#define READ_COALESCE_BITS		4		// 16 slots per device
+#define READ_COALESCE_MAX_US	100000	// upper limit of the freshness window
+#define FLINK_COALESCE_EMPTY	0
+#define FLINK_COALESCE_BUSY		1		// a bus read of addr is in flight
+#define FLINK_COALESCE_VALID	2		// value was read at start_ns
+/// @brief Result of a recent 32 bit read, shared by concurrent readers of the same address
+struct flink_coalesced_read {
+	u32  addr;			/// Address of the register
+	u32  value;			/// Value of the last completed read
+	u64  start_ns;		/// Time the bus read was started
+	u32  seq;			/// Incremented whenever a read of this slot completed
+	u8   state;			/// FLINK_COALESCE_*
+	bool stale;			/// The register was written while the read was in flight
+};
+
+/// @brief Coalesces concurrent reads of the same register within a freshness window
+struct flink_read_coalescing {
+	spinlock_t        lock;			/// Protects the slots
+	wait_queue_head_t wait;			/// Readers waiting for an in-flight read
+	u64               window_ns;	/// Freshness window, 0 disables coalescing
+	struct flink_coalesced_read slots[1 << READ_COALESCE_BITS];	/// Hashed by address
 };
 
 // ############ flink subdevice ############
 #define MAX_NOF_SUBDEVICES 256
+#define SUBDEVICE_HASH_BITS 6
 /// @brief Describes a subdevice
 struct flink_subdevice {
 	struct list_head     list;				/// Linked list of all subdevices of a device
 	struct flink_device* parent;			/// Pointer to device which this subdevice belongs
+	struct device*       sysfs_device;		/// Pointer to sysfs device structure of the subdevice node
+	struct hlist_node    function_node;		/// Entry in the function id hash table of the device
+	struct hlist_node    unique_id_node;	/// Entry in the unique id hash table of the device
+	struct flink_private_data* excl_owner;	/// File which selected the subdevice exclusively, NULL if shared
+	atomic_t             nof_mappings;		/// User space mappings of the registers (mmap), exclusive selection fails while there are any
+	struct mutex         rmw_lock;			/// Serializes read-modify-write sequences on registers of this subdevice
+	struct list_head     shadow_registers;	/// Registers with owned bits, modified under rmw_lock, read under RCU by the write paths
+	struct flink_register_cache* cache;		/// Cached registers, NULL until SET_CACHEABLE, protected by cache_lock
+	spinlock_t           cache_lock;		/// Protects the register cache, never held during bus accesses
 	u8                   id;				/// Identifies a subdevice within a device
 	u16                  function_id;		/// Identifies the function of the subdevice
 	u8                   sub_function_id;	/// Identifies the subtype of the subdevice
@@ -81,43 +221,98 @@ struct flink_subdevice {
 	u32                  unique_id;			/// unique id for this subdevice
 };
 
+// ############ flink write-behind queue ############
+#define WRITE_QUEUE_SIZE 256
+/// @brief A queued register write
+struct flink_write_entry {
+	u32 addr;
+	u32 value;
+	u8  size;
+	struct flink_private_data* owner;	/// File which queued the write, receives its error
+};
+
+/// @brief Register writes which are executed asynchronously by a worker, in order
+struct flink_write_queue {
+	spinlock_t               lock;					/// Protects all fields below
+	struct work_struct       work;					/// Drains the queue
+	wait_queue_head_t        wait;					/// Woken up whenever a write completed
+	struct flink_write_entry entries[WRITE_QUEUE_SIZE];	/// Ring buffer
+	u32                      head;					/// Index of the oldest entry
+	u32                      count;					/// Number of pending entries
+	u64                      queued;				/// Number of entries added so far
+	u64                      completed;				/// Number of entries written so far
+};
+
 // ############ flink device ############
 /// @brief Describes a device
+#define MAX_NOF_DEVICES 1024
+#define MINORS_PER_DEVICE (1 + MAX_NOF_SUBDEVICES)	/// Device node and one node per subdevice
 struct flink_device {
-	struct list_head      list;				/// Linked list of all devices
-	u8                    id;				/// Identifies a device
+	struct list_head      list;				/// Linked list of all devices (RCU protected)
+	u32                   id;				/// Identifies a device
+	struct kref           refcount;			/// Held by the bus module, the sysfs device and open files; the last flink_device_put() frees the device
 	u8                    nof_subdevices;	/// Number of subdevices
 	struct list_head      subdevices;		/// Linked list of all subdevices of this device
+	struct flink_subdevice* subdevice_table[MAX_NOF_SUBDEVICES];	/// Subdevices indexed by their id
+	DECLARE_HASHTABLE(subdevices_by_function, SUBDEVICE_HASH_BITS);	/// Subdevices hashed by function id
+	DECLARE_HASHTABLE(subdevices_by_unique_id, SUBDEVICE_HASH_BITS);	/// Subdevices hashed by unique id
 	struct flink_bus_ops* bus_ops;			/// Pointer to structure defining the bus operation functions of this device
 	struct module*        appropriated_module;	/// Pointer to bus interface modul used for this device 
 	void*                 bus_data;			/// Bus specific data
-	struct cdev*          char_device;		/// Pointer to cdev structure
-	struct device*        sysfs_device;		/// Pointer to sysfs device structure
-	struct list_head      hw_irq_data;		/// Linked list of requested IRQs
+	struct cdev           char_device;		/// Char device of the device and subdevice nodes
+	struct device*        sysfs_device;		/// Sysfs device of the device node, parent of char_device, holds a reference
+	struct flink_write_queue write_queue;	/// Queued writes of write-behind files
+	struct flink_read_coalescing coalesce;	/// Shared reads, configured by sysfs attribute read_coalesce_us
+	struct flink_timed_writes timed_writes;	/// Writes scheduled at absolute times (TIMED_WRITE)
+	u64                   irq_window_ns;	/// IRQ moderation window, 0 disables moderation (sysfs attribute irq_moderation_us)
+	u32                   irq_budget;		/// IRQs per window which switch an IRQ to moderation (sysfs attribute irq_budget)
+	struct flink_irq_data* irqs;			/// Requested IRQs indexed by IRQ nr (nof_irqs entries)
 	u32                   nof_irqs;			/// Maximum IRQ that can be registered
 	u32                   irq_offset;		/// offset for HW IRQ
 	u32                   signal_offset;	/// offset for userspace signals
 };
 
-// ############ flink irq structure (two-dimensional dynamic array) ############
+// ############ flink irq structure (array of RCU lists) ############
+#define IRQ_MODERATION_MAX_US		100000	// upper limit of the moderation window
+#define IRQ_MODERATION_BUDGET		64		// default budget per window
 /// Some data is duplicated here to avoid searching during IRQ processing.
 /// Be very careful if you change anything inside the code if it belongs to these structures.
+/// The lists are read by the IRQ handler under RCU and modified under lock_for_ioctl, entries are freed after a grace period.
 /// @brief Holds all registered IRQs with the corresponding PID.
 struct flink_irq_data {
-	struct list_head	list;					/// List of all registered IRQs
 	struct list_head	flink_process_data;		/// List to process data
 	u32					irq_nr;					/// IRQ nr without offset
 	u32					signal_count;			/// Registered signals (length of flink_signal_data). if(signal_count == 0) then the IRQ isn't registered
 	u32					signal_nr_with_offset;	/// userspace signal nr
 	u32					irq_nr_with_offset;		/// Precalculated IRQ NR to save time in IRQ routine
-	spinlock_t			irq_lock;				/// Spinnlock to avoid data races between top half and ioctl call
+	struct list_head	programs;				/// Sequencer programs triggered by this IRQ
+	struct list_head	eventfds;				/// eventfds signalled by this IRQ
+	struct list_head	subscribers;			/// Event queues of files subscribed to this IRQ
+	struct flink_device* fdev;					/// Device of the IRQ
+	raw_spinlock_t		moderation_lock;		/// Serializes the primary handler and poll_timer, protects the fields up to pending
+	u32					seq;					/// Number of occurrences of this IRQ
+	u64					timestamp;				/// Time of the last occurrence, taken by the primary handler
+	u64					window_start;			/// Start of the current moderation window
+	u32					window_count;			/// Occurrences in the current moderation window
+	bool				moderated;				/// Occurrences are counted and notified in batches by poll_timer
+	u32					pending;				/// Occurrences not notified yet (moderated only)
+	struct hrtimer		poll_timer;				/// Notifies the pending occurrences once per moderation window
+	bool				hard_irq;				/// Notify from the primary handler (FLINK_IRQ_HARD)
+	bool				notified;				/// The primary handler notified the last occurrence, the thread only sends signals
 	struct mutex		lock_for_ioctl;			/// To avoid data races when multiple processes call ioctl to add or remove an signal.
-
+} ____cacheline_aligned_in_smp;
+/// @brief An eventfd which is signalled whenever the IRQ occurs
+struct flink_irq_eventfd {
+	struct list_head			list;	/// Entry in the eventfd list of the IRQ
+	struct eventfd_ctx*			ctx;	/// The eventfd
+	struct flink_private_data*	owner;	/// File which bound the eventfd
+	struct rcu_head				rcu;	/// Deferred release after unbinding
 };
 /// @brief This structure is used in the IRQ handler to send the appropriate signal number to the correct userspace process.
 struct flink_process_data {
 	struct list_head	list;		/// List of all user space processes that have requested the IRQ
 	struct task_struct*	user_task;	/// User task to route IRQs per signal
+	struct rcu_head		rcu;		/// Deferred free after unregistering
 };
 
 // ############ Public functions ############
@@ -132,7 +327,8 @@ extern void                    flink_device_init_irq(struct flink_device* fdev,
 extern int                     flink_device_add(struct flink_device* fdev);
 extern int                     flink_device_remove(struct flink_device* fdev);
 extern int                     flink_device_delete(struct flink_device* fdev);
-extern struct flink_device*    flink_get_device_by_id(u8 flink_device_id);
+extern void                    flink_device_put(struct flink_device* fdev);
+extern struct flink_device*    flink_get_device_by_id(u32 flink_device_id);
 extern struct flink_device*    flink_get_device_by_cdev(struct cdev* char_device);
 extern struct list_head*       flink_get_device_list(void);
 
@@ -142,6 +338,8 @@ extern int                     flink_subdevice_add(struct flink_device* fdev, st
 extern int                     flink_subdevice_remove(struct flink_subdevice* fsubdev);
 extern int                     flink_subdevice_delete(struct flink_subdevice* fsubdev);
 extern struct flink_subdevice* flink_get_subdevice_by_id(struct flink_device* fdev, u8 flink_device_id);
+extern struct flink_subdevice* flink_get_subdevice_by_function(struct flink_device* fdev, u16 function_id);
+extern struct flink_subdevice* flink_get_subdevice_by_unique_id(struct flink_device* fdev, u32 unique_id);
 
 extern struct class*           flink_get_sysfs_class(void);
 
@@ -181,6 +379,296 @@ struct ioctl_container_t {
 	void*    data;
 };
 
+// ############ Extended ioctl commands ############
+// These commands are not part of the generated flink_ioctl.h (yet).
+#define READ_WRITE_BATCH		0x100
+#define READ_SUBDEVICE_TABLE	0x110
+#define FIND_SUBDEVICE			0x111
+#define MASKED_WRITE			0x120
+#define READ_FIELD				0x121
+#define WRITE_FIELD				0x122
+#define COMPARE_AND_SWAP		0x130
+#define FETCH_AND_ADD			0x131
+#define POLL_REGISTER			0x140
+#define SET_RELAXED				0x150	// argument is a pointer to a uint32_t, 0 switches relaxed ordering off
+#define FLUSH					0x151
+#define SET_WRITE_BEHIND		0x152	// argument is a pointer to a uint32_t, 0 switches write-behind off
+#define CLAIM_BITS				0x160
+#define RELEASE_BITS			0x161
+#define WRITE_OWNED_BITS		0x162
+
+// Register cache
+#define SET_CACHEABLE			0x170
+#define INVALIDATE_CACHE		0x171
+
+// Micro-sequencer
+#define LOAD_PROGRAM			0x180
+#define RUN_PROGRAM				0x181
+#define TRIGGER_PROGRAM			0x182
+#define READ_PROGRAM_RESULT		0x183
+
+// Timed writes
+#define TIMED_WRITE				0x190
+#define TIMED_WRITE_RESULT		0x191
+
+// IRQ notification
+#define BIND_IRQ_EVENTFD		0x1A0
+#define UNBIND_IRQ_EVENTFD		0x1A1
+#define SUBSCRIBE_IRQ			0x1A2
+#define UNSUBSCRIBE_IRQ			0x1A3
+#define SET_IRQ_MODE			0x1A4
+
+// Batched register accesses
+#define MAX_BATCH_ENTRIES		256	// Maximum number of entries per batch
+#define FLINK_BATCH_READ		0	// Read register into value
+#define FLINK_BATCH_WRITE		1	// Write value to register
+
+/// @brief Structure describing a single register access of a batch
+struct ioctl_batch_entry_t {
+	uint8_t  subdevice;
+	uint8_t  op;		// FLINK_BATCH_READ or FLINK_BATCH_WRITE
+	uint8_t  size;		// 1, 2 or 4 bytes
+	uint32_t offset;
+	uint32_t value;		// value to write, resp. value read
+};
+
+/// @brief Structure containing information for batched ioctl system calls
+struct ioctl_batch_container_t {
+	uint32_t nof_entries;
+	struct ioctl_batch_entry_t* entries;
+};
+
+/// @brief Structure containing information for reading the whole subdevice table.
+/// data points to an array of nof_entries subdevice records of FLINKLIB_SUBDEVICE_SIZE bytes each,
+/// nof_entries is set to the number of records actually written.
+struct ioctl_table_container_t {
+	uint32_t nof_entries;
+	void*    data;
+};
+
+// Keys for FIND_SUBDEVICE
+#define FLINK_FIND_BY_FUNCTION	0	// key is a function id
+#define FLINK_FIND_BY_UNIQUE_ID	1	// key is a unique id
+
+/// @brief Structure containing information for finding a subdevice
+struct ioctl_find_container_t {
+	uint8_t  key_type;	// FLINK_FIND_BY_FUNCTION or FLINK_FIND_BY_UNIQUE_ID
+	uint32_t key;
+	uint8_t  subdevice;	// id of the subdevice found
+};
+
+/// @brief Structure containing information for masked writes: reg = (reg & ~mask) | (value & mask)
+/// Also used for CLAIM_BITS and RELEASE_BITS (mask only) and WRITE_OWNED_BITS.
+struct ioctl_mask_container_t {
+	uint8_t  subdevice;
+	uint32_t offset;
+	uint32_t mask;
+	uint32_t value;
+	uint32_t old_value;	// register value before the write
+};
+
+/// @brief Structure containing information for accessing a bit field of width bits starting at bit shift
+struct ioctl_field_container_t {
+	uint8_t  subdevice;
+	uint32_t offset;
+	uint8_t  shift;
+	uint8_t  width;
+	uint32_t value;		// field value (right aligned)
+};
+
+/// @brief Structure containing information for atomic register operations.
+/// COMPARE_AND_SWAP writes value if the register equals compare, FETCH_AND_ADD adds value to the register.
+struct ioctl_atomic_container_t {
+	uint8_t  subdevice;
+	uint32_t offset;
+	uint32_t compare;	// expected register value (COMPARE_AND_SWAP only)
+	uint32_t value;
+	uint32_t old_value;	// register value before the operation
+};
+
+/// @brief Structure containing information for SET_CACHEABLE and INVALIDATE_CACHE.
+/// Covers the 32 bit registers in [offset, offset + size), size 0 invalidates the whole subdevice.
+struct ioctl_cache_container_t {
+	uint8_t  subdevice;
+	uint8_t  cacheable;	// SET_CACHEABLE: 1 to cache reads of the registers, 0 to stop caching
+	uint32_t offset;
+	uint32_t size;
+};
+
+// Poll strategies for POLL_REGISTER
+#define FLINK_POLL_BUSY			0	// spin on the register, for short waits on memory mapped buses
+#define FLINK_POLL_SLEEP		1	// sleep on a high resolution timer between two reads
+#define FLINK_POLL_MAX_BUSY_US	1000	// upper limit of the timeout in busy mode
+#define FLINK_POLL_DEFAULT_INTERVAL_US	10
+
+/// @brief Structure containing information for POLL_REGISTER, waits until (register & mask) == value.
+struct ioctl_poll_container_t {
+	uint8_t  subdevice;
+	uint8_t  mode;			// FLINK_POLL_BUSY or FLINK_POLL_SLEEP
+	uint32_t offset;
+	uint32_t mask;
+	uint32_t value;
+	uint32_t timeout_us;
+	uint32_t interval_us;	// sleep time between two reads (FLINK_POLL_SLEEP only), 0 for default
+	uint32_t last_value;	// last register value read
+	uint64_t elapsed_ns;	// time spent waiting
+};
+
+/// @brief Structure containing information for BIND_IRQ_EVENTFD and UNBIND_IRQ_EVENTFD
+struct ioctl_irq_eventfd_container_t {
+	uint32_t irq_nr;
+	int32_t  fd;			// eventfd to signal (BIND_IRQ_EVENTFD only)
+};
+
+/// @brief IRQ event record returned by read() on a file which subscribed IRQs (SUBSCRIBE_IRQ, argument is a pointer to the uint32_t IRQ number)
+struct flink_irq_event_t {
+	uint32_t irq_nr;
+	uint32_t count;			// number of IRQs this record stands for
+	uint32_t seq;			// per-IRQ sequence number of the last of these IRQs, gaps show lost events
+	uint32_t reserved;
+	uint64_t timestamp_ns;	// CLOCK_MONOTONIC time of the last of these IRQs
+};
+
+// IRQ handling modes (SET_IRQ_MODE)
+// The primary handler takes spinlock_t locks (event queue, eventfd and wait queue locks), so it
+// can't be registered with IRQF_NO_THREAD. On kernels which force-thread interrupt handlers
+// (PREEMPT_RT or the threadirqs boot option) it runs in a thread as well, FLINK_IRQ_HARD would
+// gain nothing and SET_IRQ_MODE fails with -EOPNOTSUPP. IRQ moderation still counts the
+// interrupts there, but in the forced thread.
+#define FLINK_IRQ_THREADED		0	// the IRQ thread does all notifications (default)
+#define FLINK_IRQ_HARD			1	// events, eventfds and programs are notified from hard interrupt context, the thread only sends signals
+
+/// @brief Structure containing information for SET_IRQ_MODE
+struct ioctl_irq_mode_container_t {
+	uint32_t irq_nr;
+	uint32_t mode;			// FLINK_IRQ_THREADED or FLINK_IRQ_HARD
+};
+
+// Clocks of timed writes
+#define FLINK_CLOCK_MONOTONIC	0
+#define FLINK_CLOCK_TAI			1
+
+/// @brief Structure containing a 32 bit register write for TIMED_WRITE, executed at time_ns
+struct ioctl_timed_write_container_t {
+	uint8_t  subdevice;
+	uint8_t  clock;			// FLINK_CLOCK_MONOTONIC or FLINK_CLOCK_TAI
+	uint32_t offset;
+	uint32_t value;
+	uint64_t time_ns;
+	uint64_t id;			// identifies the write for TIMED_WRITE_RESULT
+};
+
+/// @brief Structure for TIMED_WRITE_RESULT, waits until the write with the given id was executed
+struct ioctl_timed_write_result_t {
+	uint64_t id;
+	uint64_t executed_ns;	// time of the write in the clock of the request
+	int64_t  lateness_ns;	// executed_ns - time_ns
+};
+
+// ############ Micro-sequencer programs ############
+#define FLINK_SEQ_MAX_INSNS		256		// Maximum number of instructions per program
+#define FLINK_SEQ_MAX_RESULTS	64		// Number of result slots
+#define FLINK_SEQ_MAX_TIME_US	10000	// Upper limit of the sum of all poll timeouts and delays of a program
+#define FLINK_SEQ_MIN_PERIOD_US	100		// Shortest period of a timer trigger
+
+// Instructions, acc is the accumulator of the program
+#define FLINK_SEQ_END			0	// stop the program
+#define FLINK_SEQ_READ			1	// acc = register
+#define FLINK_SEQ_WRITE			2	// register = value
+#define FLINK_SEQ_MASKED_WRITE	3	// register = (register & ~mask) | (value & mask)
+#define FLINK_SEQ_POLL			4	// wait at most param us until (register & mask) == value, acc = register, stops the program with -ETIMEDOUT
+#define FLINK_SEQ_DELAY			5	// wait param us
+#define FLINK_SEQ_JUMP_IF		6	// continue at instruction target if (acc & mask) == value, only forward jumps
+#define FLINK_SEQ_STORE			7	// result slot target = acc
+
+/// @brief One sequencer instruction
+struct flink_seq_insn_t {
+	uint8_t  op;			// FLINK_SEQ_*
+	uint8_t  subdevice;		// register of READ, WRITE, MASKED_WRITE and POLL
+	uint16_t target;		// instruction (JUMP_IF) or result slot (STORE)
+	uint32_t offset;
+	uint32_t mask;
+	uint32_t value;
+	uint32_t param;			// time in us (POLL, DELAY)
+};
+
+/// @brief Structure containing a program for LOAD_PROGRAM
+struct ioctl_program_container_t {
+	uint32_t nof_insns;
+	struct flink_seq_insn_t* insns;
+};
+
+// Trigger sources for TRIGGER_PROGRAM
+#define FLINK_SEQ_TRIGGER_NONE	0	// only RUN_PROGRAM
+#define FLINK_SEQ_TRIGGER_IRQ	1	// run whenever flink IRQ irq_nr occurs
+#define FLINK_SEQ_TRIGGER_TIMER	2	// run every period_us
+
+/// @brief Structure containing information for TRIGGER_PROGRAM
+struct ioctl_trigger_container_t {
+	uint8_t  source;		// FLINK_SEQ_TRIGGER_*
+	uint32_t irq_nr;		// FLINK_SEQ_TRIGGER_IRQ only
+	uint32_t period_us;		// FLINK_SEQ_TRIGGER_TIMER only
+};
+
+/// @brief Results of a program run, filled in by RUN_PROGRAM and READ_PROGRAM_RESULT
+struct ioctl_program_result_t {
+	int32_t  status;		// 0 or the negative error code of the run
+	uint32_t nof_runs;		// number of completed runs
+	uint32_t results[FLINK_SEQ_MAX_RESULTS];
+};
+
+// ############ flink micro-sequencer ############
+/// @brief A verified sequencer program and the results of its last run
+struct flink_program {
+	struct flink_device*       fdev;		/// Device the program runs on
+	struct flink_private_data* pdata;		/// File which loaded the program
+	struct mutex               lock;		/// Serializes runs and protects the results
+	struct work_struct         work;		/// Runs the program on IRQ and timer triggers
+	struct hrtimer             timer;		/// Periodic trigger (FLINK_SEQ_TRIGGER_TIMER)
+	ktime_t                    period;		/// Period of the timer trigger
+	struct flink_irq_data*     irq;			/// IRQ triggering the program, NULL if none
+	struct list_head           irq_node;	/// Entry in the program list of the IRQ
+	u8                         trigger;		/// FLINK_SEQ_TRIGGER_*
+	int                        status;		/// Result of the last run
+	u32                        nof_runs;	/// Number of completed runs
+	u32                        results[FLINK_SEQ_MAX_RESULTS];	/// Result slots of the last run
+	u32                        nof_insns;	/// Number of instructions
+	struct flink_seq_insn_t    insns[];		/// The program
+};
+
+// ############ flink IRQ events ############
+/// @brief IRQ events of a file in event mode, filled by the IRQ handlers and drained by read()
+#define FLINK_EVENT_QUEUE_SIZE	256		// events, power of 2
+struct flink_event_queue {
+	spinlock_t			lock;		/// Serializes the IRQ handlers adding events
+	struct mutex		read_lock;	/// Serializes readers
+	wait_queue_head_t	wait;		/// Woken up when events were added
+	struct rcu_head		rcu;		/// Deferred free, IRQ handlers may still add events
+	DECLARE_KFIFO(fifo, struct flink_irq_event_t, FLINK_EVENT_QUEUE_SIZE);	/// The events
+};
+
+/// @brief Event queue of a file subscribed to an IRQ
+struct flink_irq_subscriber {
+	struct list_head			list;	/// Entry in the subscriber list of the IRQ
+	struct flink_event_queue*	queue;	/// Event queue of the subscribed file
+	struct rcu_head				rcu;	/// Deferred free after unsubscribing
+};
+
+// ############ io_uring passthrough commands ############
+// Command codes (sqe->cmd_op) for IORING_OP_URING_CMD
+#define FLINK_URING_READ		0x01	// read one register, the value is stored at data
+#define FLINK_URING_WRITE		0x02	// write data to one register
+#define FLINK_URING_BATCH		0x03	// execute the batch container pointed to by data
+
+/// @brief Command payload in sqe->cmd, fits into a regular 64 byte submission queue entry.
+struct flink_uring_cmd_t {
+	uint8_t  subdevice;
+	uint8_t  size;			// access size in bytes (1, 2 or 4)
+	uint16_t reserved;
+	uint32_t offset;
+	uint64_t data;			// value (FLINK_URING_WRITE) or user space pointer
+};
+
 // size of struct 'flink_subdevice' without linked list information (in bytes)
 #define FLINKLIB_SUBDEVICE_SIZE		(sizeof(struct flink_subdevice)-offsetof(struct flink_subdevice,id))
 
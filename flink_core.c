@@ -42,40 +42,2351 @@
 #include <linux/interrupt.h>
 #include <linux/signal.h>
 #include <linux/sched/signal.h>
+#include <linux/idr.h>
+#include <linux/rculist.h>
+#include <linux/ktime.h>
+#include <linux/hrtimer.h>
+#include <linux/version.h>
+#include <linux/workqueue.h>
+#include <linux/static_call.h>
+#include <linux/hash.h>
+#include <linux/eventfd.h>
 
 #include "flink.h"
 
+// io_uring passthrough needs the uring_cmd API of 6.7
+#if defined(CONFIG_IO_URING) && LINUX_VERSION_CODE >= KERNEL_VERSION(6,7,0)
+#include <linux/io_uring/cmd.h>
+#define FLINK_URING_CMD
+#endif
+
+
+// eventfd_signal() lost its count argument in 6.8 and always adds 1
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,8,0)
+static inline void flink_eventfd_signal(struct eventfd_ctx* ctx, u32 count) {
+	while(count-- > 0) {
+		eventfd_signal(ctx);
+	}
+}
+#else
+#define flink_eventfd_signal(ctx, count) eventfd_signal(ctx, count)
+#endif
+
+// hrtimer_setup() replaced hrtimer_init() and the assignment of the callback in 6.13
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,13,0)
+#define flink_hrtimer_setup(timer, fn, clock, mode) hrtimer_setup(timer, fn, clock, mode)
+#else
+static inline void flink_hrtimer_setup(struct hrtimer* timer, enum hrtimer_restart (*fn)(struct hrtimer*), clockid_t clock, enum hrtimer_mode mode) {
+	hrtimer_init(timer, clock, mode);
+	timer->function = fn;
+}
+#endif
+
 #define MODULE_NAME THIS_MODULE->name
 #define SYSFS_CLASS_NAME "flink"
 #define MAX_DEV_NAME_LENGTH 15
 
-MODULE_AUTHOR("Martin Zueger <martin@zueger.eu>");
-MODULE_DESCRIPTION("fLink core module");
-MODULE_LICENSE("Dual BSD/GPL");
+MODULE_AUTHOR("Martin Zueger <martin@zueger.eu>");
+MODULE_DESCRIPTION("fLink core module");
+MODULE_LICENSE("Dual BSD/GPL");
+
+static LIST_HEAD(device_list);			// RCU protected, modified under device_registry_lock
+static DEFINE_IDR(device_idr);			// Device ids, RCU safe lookup
+static DEFINE_MUTEX(device_registry_lock);	// Serializes adding and removing devices
+static LIST_HEAD(loaded_if_modules);
+static struct class* sysfs_class;
+static dev_t flink_devt;				// First device number of the char dev region of all devices
+
+// ###### Internal Function Prototypes ######
+// do NOT call this directly!!! this function is called over an irq number
+static irqreturn_t flink_threaded_irq_handler(int irq, void *dev_id);
+static void flink_coalesce_invalidate(struct flink_device* fdev, u32 addr, u32 size);
+
+// ############ Bus operation dispatch ############
+/* Register accesses of devices whose bus operations are flink_direct_bus_ops
+ * go through static calls which point directly to the bus functions, which
+ * avoids the indirect call (and its retpoline). All other devices call through
+ * fdev->bus_ops. Writes drop shared read results of the written register if
+ * read coalescing is enabled.
+ */
+static struct flink_bus_ops* flink_direct_bus_ops;	// Target of the static calls, NULL while they are not patched
+static atomic_t nof_live_devices = ATOMIC_INIT(0);	// Allocated devices which are not freed yet
+
+#define FLINK_DEFINE_READ_CALL(bits) \
+	static u##bits flink_bus_read##bits##_indirect(struct flink_device* fdev, u32 addr) { \
+		return fdev->bus_ops->read##bits(fdev, addr); \
+	} \
+	DEFINE_STATIC_CALL(flink_bus_read##bits##_call, flink_bus_read##bits##_indirect); \
+	static inline u##bits flink_bus_read##bits(struct flink_device* fdev, u32 addr) { \
+		if(likely(fdev->bus_ops == READ_ONCE(flink_direct_bus_ops))) { \
+			return static_call(flink_bus_read##bits##_call)(fdev, addr); \
+		} \
+		return fdev->bus_ops->read##bits(fdev, addr); \
+	}
+
+#define FLINK_DEFINE_WRITE_CALL(bits) \
+	static int flink_bus_write##bits##_indirect(struct flink_device* fdev, u32 addr, u##bits val) { \
+		return fdev->bus_ops->write##bits(fdev, addr, val); \
+	} \
+	DEFINE_STATIC_CALL(flink_bus_write##bits##_call, flink_bus_write##bits##_indirect); \
+	static inline int flink_bus_write##bits(struct flink_device* fdev, u32 addr, u##bits val) { \
+		int ret; \
+		if(likely(fdev->bus_ops == READ_ONCE(flink_direct_bus_ops))) { \
+			ret = static_call(flink_bus_write##bits##_call)(fdev, addr, val); \
+		} else { \
+			ret = fdev->bus_ops->write##bits(fdev, addr, val); \
+		} \
+		if(unlikely(READ_ONCE(fdev->coalesce.window_ns) != 0)) { \
+			flink_coalesce_invalidate(fdev, addr, sizeof(val)); \
+		} \
+		return ret; \
+	}
+
+FLINK_DEFINE_READ_CALL(8)
+FLINK_DEFINE_READ_CALL(16)
+FLINK_DEFINE_READ_CALL(32)
+FLINK_DEFINE_WRITE_CALL(8)
+FLINK_DEFINE_WRITE_CALL(16)
+FLINK_DEFINE_WRITE_CALL(32)
+
+/// @brief Bus operations in use and number of devices using them
+struct flink_bus_type {
+	struct list_head      list;
+	struct flink_bus_ops* bus_ops;
+	unsigned int          nof_devices;
+};
+
+static LIST_HEAD(bus_types);			// Modified under device_registry_lock
+static unsigned int nof_bus_types;
+
+/**
+ * flink_update_bus_calls() - retargets the static calls of the register accesses
+ *
+ * A register access may be preempted between the compare with flink_direct_bus_ops
+ * and the static call. So the static calls are never retargeted from one bus to
+ * another: they are reset to the indirect functions once the last device of their
+ * bus was removed, and patched to a bus only while no device of another bus is
+ * alive, including removed devices which are still open.
+ *
+ * Must be called with device_registry_lock held, after a device was registered
+ * and after the last device of a bus type was removed.
+ */
+static void flink_update_bus_calls(void) {
+	struct flink_bus_type* type;
+	struct flink_bus_ops* ops;
+	if(flink_direct_bus_ops != NULL) {
+		list_for_each_entry(type, &bus_types, list) {
+			if(type->bus_ops == flink_direct_bus_ops) {
+				return;
+			}
+		}
+		// no device of the bus is left, its module may be unloaded
+		WRITE_ONCE(flink_direct_bus_ops, NULL);
+		static_call_update(flink_bus_read8_call, flink_bus_read8_indirect);
+		static_call_update(flink_bus_read16_call, flink_bus_read16_indirect);
+		static_call_update(flink_bus_read32_call, flink_bus_read32_indirect);
+		static_call_update(flink_bus_write8_call, flink_bus_write8_indirect);
+		static_call_update(flink_bus_write16_call, flink_bus_write16_indirect);
+		static_call_update(flink_bus_write32_call, flink_bus_write32_indirect);
+	}
+	if(nof_bus_types != 1) {
+		return;
+	}
+	type = list_first_entry(&bus_types, struct flink_bus_type, list);
+	ops = type->bus_ops;
+	if(!ops->read8 || !ops->read16 || !ops->read32 || !ops->write8 || !ops->write16 || !ops->write32) {
+		return;
+	}
+	if(atomic_read(&nof_live_devices) != type->nof_devices) {
+		return;
+	}
+	static_call_update(flink_bus_read8_call, ops->read8);
+	static_call_update(flink_bus_read16_call, ops->read16);
+	static_call_update(flink_bus_read32_call, ops->read32);
+	static_call_update(flink_bus_write8_call, ops->write8);
+	static_call_update(flink_bus_write16_call, ops->write16);
+	static_call_update(flink_bus_write32_call, ops->write32);
+	WRITE_ONCE(flink_direct_bus_ops, ops);
+	#if defined(DBG)
+		printk(KERN_DEBUG "[%s] Direct register access for %u device(s)", MODULE_NAME, type->nof_devices);
+	#endif
+}
+
+/**
+ * flink_bus_type_get() - registers a device of a bus type
+ * @bus_ops: the bus operations of the device
+ *
+ * Must be called with device_registry_lock held. Returns 0 or -ENOMEM.
+ */
+static int flink_bus_type_get(struct flink_bus_ops* bus_ops) {
+	struct flink_bus_type* type;
+	list_for_each_entry(type, &bus_types, list) {
+		if(type->bus_ops == bus_ops) {
+			type->nof_devices++;
+			flink_update_bus_calls();
+			return 0;
+		}
+	}
+	type = kmalloc(sizeof(*type), GFP_KERNEL);
+	if(type == NULL) {
+		return -ENOMEM;
+	}
+	type->bus_ops = bus_ops;
+	type->nof_devices = 1;
+	list_add_tail(&(type->list), &bus_types);
+	nof_bus_types++;
+	flink_update_bus_calls();
+	return 0;
+}
+
+/**
+ * flink_bus_type_put() - unregisters a device of a bus type
+ * @bus_ops: the bus operations of the device
+ *
+ * Must be called with device_registry_lock held.
+ */
+static void flink_bus_type_put(struct flink_bus_ops* bus_ops) {
+	struct flink_bus_type* type;
+	list_for_each_entry(type, &bus_types, list) {
+		if(type->bus_ops == bus_ops) {
+			if(--type->nof_devices == 0) {
+				list_del(&(type->list));
+				kfree(type);
+				nof_bus_types--;
+				flink_update_bus_calls();
+			}
+			return;
+		}
+	}
+}
+
+/**
+ * flink_bus_width_supported() - checks if the bus supports an access size
+ * @fdev: the flink device
+ * @size: access size in bytes
+ *
+ * Buses which do not report their capabilities are assumed to support all sizes.
+ */
+static inline bool flink_bus_width_supported(struct flink_device* fdev, size_t size) {
+	u32 caps = fdev->bus_ops->caps;
+	switch(size) {
+		case 1:  return caps == 0 || (caps & FLINK_CAP_8BIT);
+		case 2:  return caps == 0 || (caps & FLINK_CAP_16BIT);
+		case 4:  return caps == 0 || (caps & FLINK_CAP_32BIT);
+		default: return false;
+	}
+}
+
+/**
+ * flink_bus_relaxed_supported() - checks if the bus offers relaxed 32 bit accesses
+ * @fdev: the flink device
+ */
+static inline bool flink_bus_relaxed_supported(struct flink_device* fdev) {
+	return (fdev->bus_ops->caps & FLINK_CAP_RELAXED) && fdev->bus_ops->read32_relaxed != NULL && fdev->bus_ops->write32_relaxed != NULL;
+}
+
+// ############ Read coalescing ############
+
+/**
+ * flink_coalesce_invalidate() - drops shared read results after a write
+ * @fdev: the flink device
+ * @addr: address of the first written byte
+ * @size: number of bytes written
+ *
+ * A read which is in flight is marked stale, its result is then only handed to
+ * the readers which joined before the write.
+ */
+static void flink_coalesce_invalidate(struct flink_device* fdev, u32 addr, u32 size) {
+	struct flink_read_coalescing* c = &(fdev->coalesce);
+	struct flink_coalesced_read* slot;
+	u32 word;
+	spin_lock(&(c->lock));
+	for(word = addr & ~(u32)(sizeof(u32) - 1); word < addr + size; word += sizeof(u32)) {
+		slot = &(c->slots[hash_32(word / sizeof(u32), READ_COALESCE_BITS)]);
+		if(slot->addr != word) {
+			continue;
+		}
+		if(slot->state == FLINK_COALESCE_BUSY) {
+			slot->stale = true;
+		}
+		else {
+			slot->state = FLINK_COALESCE_EMPTY;
+		}
+	}
+	spin_unlock(&(c->lock));
+}
+
+/**
+ * flink_coalesced_read32() - reads a 32 bit register, sharing the bus access with concurrent readers
+ * @fdev: the flink device
+ * @addr: address of the register
+ * @relaxed: use the relaxed accessor for the bus access
+ *
+ * A read which was started less than the freshness window ago is reused:
+ * a completed read returns its value, an in-flight read is waited for.
+ * Otherwise the register is read from the bus and the result is published.
+ * Reads colliding with an in-flight read of another address go to the bus.
+ */
+static u32 flink_coalesced_read32(struct flink_device* fdev, u32 addr, bool relaxed) {
+	struct flink_read_coalescing* c = &(fdev->coalesce);
+	struct flink_coalesced_read* slot = &(c->slots[hash_32(addr / sizeof(u32), READ_COALESCE_BITS)]);
+	u64 now = ktime_get_ns();
+	u32 seq;
+	u32 val;
+	
+	spin_lock(&(c->lock));
+	if(slot->addr == addr && slot->state != FLINK_COALESCE_EMPTY && !slot->stale && now - slot->start_ns <= c->window_ns) {
+		if(slot->state == FLINK_COALESCE_VALID) {
+			val = slot->value;
+			spin_unlock(&(c->lock));
+			return val;
+		}
+		// join the in-flight read
+		seq = slot->seq;
+		spin_unlock(&(c->lock));
+		wait_event(c->wait, READ_ONCE(slot->seq) != seq);
+		spin_lock(&(c->lock));
+		if(slot->seq == seq + 1) {
+			val = slot->value;
+			spin_unlock(&(c->lock));
+			return val;
+		}
+		spin_unlock(&(c->lock));
+		goto bus_read;
+	}
+	if(slot->state == FLINK_COALESCE_BUSY) {
+		spin_unlock(&(c->lock));
+		goto bus_read;
+	}
+	slot->addr = addr;
+	slot->state = FLINK_COALESCE_BUSY;
+	slot->stale = false;
+	slot->start_ns = now;
+	spin_unlock(&(c->lock));
+	
+	val = relaxed ? fdev->bus_ops->read32_relaxed(fdev, addr) : flink_bus_read32(fdev, addr);
+	
+	spin_lock(&(c->lock));
+	slot->value = val;
+	slot->seq++;
+	slot->state = slot->stale ? FLINK_COALESCE_EMPTY : FLINK_COALESCE_VALID;
+	spin_unlock(&(c->lock));
+	if(wq_has_sleeper(&(c->wait))) {
+		wake_up_all(&(c->wait));
+	}
+	return val;
+	
+bus_read:
+	return relaxed ? fdev->bus_ops->read32_relaxed(fdev, addr) : flink_bus_read32(fdev, addr);
+}
+
+static inline bool flink_coalescing(struct flink_device* fdev) {
+	return unlikely(READ_ONCE(fdev->coalesce.window_ns) != 0);
+}
+
+/**
+ * flink_bus_read32_mode() - reads a 32 bit register with or without relaxed ordering
+ * @fdev: the flink device
+ * @addr: address of the register
+ * @relaxed: use the relaxed accessor, only allowed if flink_bus_relaxed_supported()
+ *
+ * Concurrent reads of the same register are coalesced if enabled for the device.
+ */
+static inline u32 flink_bus_read32_mode(struct flink_device* fdev, u32 addr, bool relaxed) {
+	if(flink_coalescing(fdev)) {
+		return flink_coalesced_read32(fdev, addr, relaxed);
+	}
+	if(relaxed) {
+		return fdev->bus_ops->read32_relaxed(fdev, addr);
+	}
+	return flink_bus_read32(fdev, addr);
+}
+
+/**
+ * flink_bus_write32_mode() - writes a 32 bit register with or without relaxed ordering
+ * @fdev: the flink device
+ * @addr: address of the register
+ * @val: value to write
+ * @relaxed: use the relaxed accessor, only allowed if flink_bus_relaxed_supported()
+ */
+static inline int flink_bus_write32_mode(struct flink_device* fdev, u32 addr, u32 val, bool relaxed) {
+	if(relaxed) {
+		int ret = fdev->bus_ops->write32_relaxed(fdev, addr, val);
+		if(flink_coalescing(fdev)) {
+			flink_coalesce_invalidate(fdev, addr, sizeof(val));
+		}
+		return ret;
+	}
+	return flink_bus_write32(fdev, addr, val);
+}
+
+/**
+ * flink_bus_flush() - waits until all previous accesses to a device are completed
+ * @fdev: the flink device
+ *
+ * Orders relaxed accesses and pushes out posted writes. Buses without a flush
+ * operation complete every access synchronously.
+ */
+static int flink_bus_flush(struct flink_device* fdev) {
+	if(fdev->bus_ops->flush != NULL) {
+		return fdev->bus_ops->flush(fdev);
+	}
+	return 0;
+}
+
+/**
+ * flink_bus_read_block() - reads a block of 32 bit registers
+ * @fdev: the flink device
+ * @addr: address of the first register
+ * @buf: kernel buffer for count registers
+ * @count: number of registers
+ * @mode: FLINK_BLOCK_INCREMENT or FLINK_BLOCK_FIXED
+ *
+ * Uses the block transfer of the bus if available. Returns 0 or a negative error code.
+ */
+static int flink_bus_read_block(struct flink_device* fdev, u32 addr, u32* buf, u32 count, u32 mode) {
+	u32 i;
+	if(fdev->bus_ops->read_block != NULL) {
+		return fdev->bus_ops->read_block(fdev, addr, buf, count, mode);
+	}
+	for(i = 0; i < count; i++) {
+		buf[i] = flink_bus_read32_mode(fdev, (mode & FLINK_BLOCK_FIXED) ? addr : addr + i * sizeof(u32), mode & FLINK_BLOCK_RELAXED);
+	}
+	return 0;
+}
+
+/**
+ * flink_bus_write_block() - writes a block of 32 bit registers
+ * @fdev: the flink device
+ * @addr: address of the first register
+ * @buf: kernel buffer with count registers
+ * @count: number of registers
+ * @mode: FLINK_BLOCK_INCREMENT or FLINK_BLOCK_FIXED
+ *
+ * Uses the block transfer of the bus if available. Returns 0 or a negative error code.
+ */
+static int flink_bus_write_block(struct flink_device* fdev, u32 addr, const u32* buf, u32 count, u32 mode) {
+	u32 i;
+	if(fdev->bus_ops->write_block != NULL) {
+		int ret = fdev->bus_ops->write_block(fdev, addr, buf, count, mode);
+		if(flink_coalescing(fdev)) {
+			flink_coalesce_invalidate(fdev, addr, (mode & FLINK_BLOCK_FIXED) ? sizeof(u32) : count * sizeof(u32));
+		}
+		return ret;
+	}
+	for(i = 0; i < count; i++) {
+		flink_bus_write32_mode(fdev, (mode & FLINK_BLOCK_FIXED) ? addr : addr + i * sizeof(u32), buf[i], mode & FLINK_BLOCK_RELAXED);
+	}
+	return 0;
+}
+
+// ############ Register cache ############
+
+/**
+ * flink_header_read32() - answers a read of the subdevice header
+ * @subdev: the subdevice
+ * @offset: offset of the header word, aligned and below SUB_HEADER_SIZE
+ *
+ * The header never changes at runtime, it is rebuilt from the values read by
+ * the scan without a bus access.
+ */
+static inline u32 flink_header_read32(struct flink_subdevice* subdev, u32 offset) {
+	switch(offset) {
+		case SUBDEV_FUNCTION_OFFSET:    return ((u32)subdev->function_id << 16) | ((u32)subdev->sub_function_id << 8) | subdev->function_version;
+		case SUBDEV_SIZE_OFFSET:        return subdev->mem_size;
+		case SUBDEV_NOFCHANNELS_OFFSET: return subdev->nof_channels;
+		default:                        return subdev->unique_id;
+	}
+}
+
+/**
+ * flink_cache_read32() - reads a 32 bit register through the register cache
+ * @subdev: the subdevice containing the register
+ * @offset: offset of the register within the subdevice
+ * @relaxed: use relaxed ordering if the register is read from the bus
+ *
+ * The subdevice header and cacheable registers with a valid cache entry are
+ * answered without a bus access. A miss is filled unless the register was
+ * invalidated while the bus was read.
+ */
+static u32 flink_cache_read32(struct flink_subdevice* subdev, u32 offset, bool relaxed) {
+	struct flink_device* fdev = subdev->parent;
+	struct flink_register_cache* cache;
+	struct flink_cached_register* reg;
+	u32 index = offset / sizeof(u32);
+	u32 generation;
+	u32 val;
+	
+	if(unlikely(offset < SUB_HEADER_SIZE) && (offset % sizeof(u32)) == 0) {
+		return flink_header_read32(subdev, offset);
+	}
+	if(likely(READ_ONCE(subdev->cache) == NULL) || (offset % sizeof(u32)) != 0) {
+		return flink_bus_read32_mode(fdev, subdev->base_addr + offset, relaxed);
+	}
+	spin_lock(&(subdev->cache_lock));
+	cache = subdev->cache;
+	if(index >= cache->nof_registers || !cache->regs[index].cacheable) {
+		spin_unlock(&(subdev->cache_lock));
+		return flink_bus_read32_mode(fdev, subdev->base_addr + offset, relaxed);
+	}
+	reg = &(cache->regs[index]);
+	if(reg->valid) {
+		val = reg->value;
+		spin_unlock(&(subdev->cache_lock));
+		return val;
+	}
+	generation = cache->generation;
+	spin_unlock(&(subdev->cache_lock));
+	
+	val = flink_bus_read32_mode(fdev, subdev->base_addr + offset, relaxed);
+	
+	spin_lock(&(subdev->cache_lock));
+	cache = subdev->cache;
+	reg = &(cache->regs[index]);
+	if(cache->generation == generation && reg->cacheable && !reg->valid) {
+		reg->value = val;
+		reg->valid = true;
+	}
+	spin_unlock(&(subdev->cache_lock));
+	return val;
+}
+
+/**
+ * flink_cache_invalidate() - invalidates cached registers
+ * @subdev: the subdevice
+ * @offset: offset of the first byte to invalidate
+ * @size: number of bytes to invalidate, 0 for all registers of the subdevice
+ */
+static void flink_cache_invalidate(struct flink_subdevice* subdev, u32 offset, u32 size) {
+	struct flink_register_cache* cache;
+	u32 i, last;
+	if(likely(READ_ONCE(subdev->cache) == NULL)) {
+		return;
+	}
+	spin_lock(&(subdev->cache_lock));
+	cache = subdev->cache;
+	last = (size == 0) ? cache->nof_registers : min_t(u32, DIV_ROUND_UP(offset + size, sizeof(u32)), cache->nof_registers);
+	for(i = (size == 0) ? 0 : offset / sizeof(u32); i < last; i++) {
+		cache->regs[i].valid = false;
+	}
+	cache->generation++;
+	spin_unlock(&(subdev->cache_lock));
+}
+
+/**
+ * flink_cache_generation() - samples the cache generation before a register write
+ * @subdev: the subdevice
+ *
+ * Must be called before the bus write and passed to flink_register_written(),
+ * which only stores the written value if no other write or invalidation
+ * completed in between.
+ */
+static inline u32 flink_cache_generation(struct flink_subdevice* subdev) {
+	u32 generation;
+	if(likely(READ_ONCE(subdev->cache) == NULL)) {
+		return 0;
+	}
+	spin_lock(&(subdev->cache_lock));
+	generation = subdev->cache->generation;
+	spin_unlock(&(subdev->cache_lock));
+	return generation;
+}
+
+/**
+ * flink_cache_update() - keeps the register cache up to date after a write
+ * @subdev: the subdevice
+ * @offset: offset of the written register
+ * @size: access size in bytes
+ * @value: value written
+ * @generation: cache generation sampled before the bus write (flink_cache_generation())
+ *
+ * Aligned 32 bit writes update the cached value, narrower writes invalidate it.
+ * Concurrent writes to a register are not ordered with their cache updates:
+ * if another write completed since the generation was sampled, the register
+ * is invalidated instead, so the cache never keeps the value which lost on the bus.
+ */
+static inline void flink_cache_update(struct flink_subdevice* subdev, u32 offset, u32 size, u32 value, u32 generation) {
+	struct flink_register_cache* cache;
+	u32 index = offset / sizeof(u32);
+	if(likely(READ_ONCE(subdev->cache) == NULL)) {
+		return;
+	}
+	if(size != sizeof(u32) || (offset % sizeof(u32)) != 0) {
+		flink_cache_invalidate(subdev, offset, size);
+		return;
+	}
+	spin_lock(&(subdev->cache_lock));
+	cache = subdev->cache;
+	if(index < cache->nof_registers && cache->regs[index].cacheable) {
+		cache->regs[index].value = value;
+		cache->regs[index].valid = (cache->generation == generation);
+	}
+	cache->generation++;
+	spin_unlock(&(subdev->cache_lock));
+}
+
+/**
+ * flink_update_shadow_register() - keeps the shadows of claimed registers up to date after a write
+ * @subdev: the subdevice
+ * @offset: offset of the written register
+ * @size: access size in bytes, or the size of a block
+ * @value: value written
+ *
+ * A 32 bit write replaces the shadow, other writes overlapping a shadowed
+ * register mark it stale. Called without the rmw_lock, the list is walked under RCU.
+ */
+static inline void flink_update_shadow_register(struct flink_subdevice* subdev, u32 offset, u32 size, u32 value) {
+	struct flink_shadow_register* reg;
+	if(likely(list_empty(&(subdev->shadow_registers)))) {
+		return;
+	}
+	rcu_read_lock();
+	list_for_each_entry_rcu(reg, &(subdev->shadow_registers), list) {
+		if(reg->offset == offset && size == sizeof(u32)) {
+			WRITE_ONCE(reg->value, value);
+			WRITE_ONCE(reg->stale, false);
+		}
+		else if(reg->offset < offset + size && offset < reg->offset + sizeof(u32)) {
+			WRITE_ONCE(reg->stale, true);
+		}
+	}
+	rcu_read_unlock();
+}
+
+/**
+ * flink_register_written() - updates the kernel copies of a register after a write
+ * @subdev: the subdevice
+ * @offset: offset of the written register
+ * @size: access size in bytes, or the size of a block
+ * @value: value written, ignored for blocks
+ * @generation: cache generation sampled before the bus write (flink_cache_generation())
+ *
+ * Must be called after every register write through the flink core, it keeps
+ * the register cache and the shadows of claimed bits (CLAIM_BITS) up to date.
+ */
+static inline void flink_register_written(struct flink_subdevice* subdev, u32 offset, u32 size, u32 value, u32 generation) {
+	flink_cache_update(subdev, offset, size, value, generation);
+	flink_update_shadow_register(subdev, offset, size, value);
+}
+
+/**
+ * flink_cache_set_cacheable() - marks registers as cacheable or not cacheable
+ * @subdev: the subdevice
+ * @offset: offset of the first register, must be a multiple of 4
+ * @size: number of bytes, must be a multiple of 4
+ * @cacheable: true to cache the registers
+ *
+ * The cache is enlarged if necessary. The registers are invalidated, so the
+ * next read fetches them from the bus. Returns 0, -EINVAL or -ENOMEM.
+ */
+static int flink_cache_set_cacheable(struct flink_subdevice* subdev, u32 offset, u32 size, bool cacheable) {
+	struct flink_register_cache* cache;
+	struct flink_register_cache* old = NULL;
+	u32 first = offset / sizeof(u32);
+	u32 last = (offset + size) / sizeof(u32);
+	u32 i;
+	
+	if(size == 0 || (offset % sizeof(u32)) != 0 || (size % sizeof(u32)) != 0 || offset > subdev->mem_size || size > subdev->mem_size - offset) {
+		return -EINVAL;
+	}
+	mutex_lock(&(subdev->rmw_lock));	// serializes resizing of the cache
+	cache = subdev->cache;
+	if(cacheable && (cache == NULL || cache->nof_registers < last)) {
+		cache = kzalloc(struct_size(cache, regs, last), GFP_KERNEL);
+		if(cache == NULL) {
+			mutex_unlock(&(subdev->rmw_lock));
+			return -ENOMEM;
+		}
+		cache->nof_registers = last;
+		spin_lock(&(subdev->cache_lock));
+		old = subdev->cache;
+		if(old != NULL) {
+			memcpy(cache->regs, old->regs, old->nof_registers * sizeof(cache->regs[0]));
+			cache->generation = old->generation;
+		}
+		WRITE_ONCE(subdev->cache, cache);
+		spin_unlock(&(subdev->cache_lock));
+	}
+	if(cache != NULL) {
+		spin_lock(&(subdev->cache_lock));
+		for(i = first; i < min(last, cache->nof_registers); i++) {
+			cache->regs[i].cacheable = cacheable;
+			cache->regs[i].valid = false;
+		}
+		cache->generation++;
+		spin_unlock(&(subdev->cache_lock));
+	}
+	mutex_unlock(&(subdev->rmw_lock));
+	kfree(old);
+	return 0;
+}
+
+// ############ Write-behind queue ############
+
+static void flink_write_queue_work(struct work_struct* work) {
+	struct flink_write_queue* q = container_of(work, struct flink_write_queue, work);
+	struct flink_device* fdev = container_of(q, struct flink_device, write_queue);
+	struct flink_write_entry e;
+	int error;
+	
+	spin_lock(&(q->lock));
+	while(q->count > 0) {
+		e = q->entries[q->head];
+		q->head = (q->head + 1) % WRITE_QUEUE_SIZE;
+		q->count--;
+		spin_unlock(&(q->lock));
+		switch(e.size) {
+			case 1:  error = flink_bus_write8(fdev, e.addr, (u8)e.value);   break;
+			case 2:  error = flink_bus_write16(fdev, e.addr, (u16)e.value); break;
+			default: error = flink_bus_write32(fdev, e.addr, e.value);      break;
+		}
+		spin_lock(&(q->lock));
+		if(error < 0 && e.owner->write_error == 0) {
+			e.owner->write_error = (error == UNKOWN_ERROR) ? -EIO : error;
+		}
+		q->completed++;
+		wake_up(&(q->wait));
+	}
+	spin_unlock(&(q->lock));
+}
+
+static void flink_write_queue_init(struct flink_write_queue* q) {
+	spin_lock_init(&(q->lock));
+	INIT_WORK(&(q->work), flink_write_queue_work);
+	init_waitqueue_head(&(q->wait));
+}
+
+/**
+ * flink_write_queue_add() - queues a register write
+ * @pdata: private data of the writing file, it must wait for the queue before it is freed
+ * @addr: address of the register
+ * @value: value to write
+ * @size: access size in bytes
+ *
+ * A write to the same register as the last pending write of the same file replaces its value.
+ * Blocks while the queue is full. Returns 0 or -ERESTARTSYS.
+ */
+static int flink_write_queue_add(struct flink_private_data* pdata, u32 addr, u32 value, u8 size) {
+	struct flink_write_queue* q = &(pdata->fdev->write_queue);
+	struct flink_write_entry* e;
+	int error;
+	
+	spin_lock(&(q->lock));
+	for(;;) {
+		if(q->count > 0) {
+			e = &(q->entries[(q->head + q->count - 1) % WRITE_QUEUE_SIZE]);
+			if(e->addr == addr && e->size == size && e->owner == pdata) {
+				e->value = value;
+				spin_unlock(&(q->lock));
+				return 0;
+			}
+		}
+		if(q->count < WRITE_QUEUE_SIZE) {
+			break;
+		}
+		spin_unlock(&(q->lock));
+		error = wait_event_interruptible(q->wait, READ_ONCE(q->count) < WRITE_QUEUE_SIZE);
+		if(error) {
+			return error;
+		}
+		spin_lock(&(q->lock));
+	}
+	e = &(q->entries[(q->head + q->count) % WRITE_QUEUE_SIZE]);
+	e->addr = addr;
+	e->value = value;
+	e->size = size;
+	e->owner = pdata;
+	q->count++;
+	q->queued++;
+	spin_unlock(&(q->lock));
+	queue_work(system_wq, &(q->work));
+	return 0;
+}
+
+static bool flink_write_queue_reached(struct flink_write_queue* q, u64 target) {
+	bool reached;
+	spin_lock(&(q->lock));
+	reached = (q->completed >= target);
+	spin_unlock(&(q->lock));
+	return reached;
+}
+
+/**
+ * flink_write_queue_wait() - waits until all writes queued so far are executed
+ * @fdev: the flink device
+ */
+static void flink_write_queue_wait(struct flink_device* fdev) {
+	struct flink_write_queue* q = &(fdev->write_queue);
+	u64 target;
+	spin_lock(&(q->lock));
+	target = q->queued;
+	spin_unlock(&(q->lock));
+	wait_event(q->wait, flink_write_queue_reached(q, target));
+}
+
+/**
+ * flink_write_queue_sync() - waits for the queued writes and reports the errors of a file
+ * @pdata: private data of the file
+ *
+ * Returns the first error of a write queued by the file since the last call, or 0.
+ */
+static int flink_write_queue_sync(struct flink_private_data* pdata) {
+	struct flink_write_queue* q = &(pdata->fdev->write_queue);
+	int error;
+	flink_write_queue_wait(pdata->fdev);
+	spin_lock(&(q->lock));
+	error = pdata->write_error;
+	pdata->write_error = 0;
+	spin_unlock(&(q->lock));
+	return error;
+}
+
+/**
+ * flink_sync() - completes all previous accesses of a file
+ * @pdata: private data of the file
+ *
+ * Drains the write-behind queue and flushes the bus, used by ioctl FLUSH and fsync().
+ */
+static int flink_sync(struct flink_private_data* pdata) {
+	int error = flink_write_queue_sync(pdata);
+	int flush_error = flink_bus_flush(pdata->fdev);
+	return error ? error : flush_error;
+}
+
+/**
+ * flink_write_behind() - queues a single register write from user space
+ * @pdata: private data of the writing file
+ * @subdev: the subdevice containing the register
+ * @offset: offset of the register within the subdevice
+ * @data: user space buffer
+ * @size: access size in bytes (1, 2 or 4)
+ *
+ * The register cache is updated when the write is queued.
+ * Returns the number of bytes queued or a negative error code.
+ */
+static ssize_t flink_write_behind(struct flink_private_data* pdata, struct flink_subdevice* subdev, u32 offset, const char __user* data, size_t size) {
+	u32 value;
+	int error;
+	switch(size) {
+		case 1: {
+			u8 wdata;
+			if(copy_from_user(&wdata, data, sizeof(wdata)) != 0) return -EFAULT;
+			value = wdata;
+			break;
+		}
+		case 2: {
+			u16 wdata;
+			if(copy_from_user(&wdata, data, sizeof(wdata)) != 0) return -EFAULT;
+			value = wdata;
+			break;
+		}
+		default:
+			if(copy_from_user(&value, data, sizeof(value)) != 0) return -EFAULT;
+			break;
+	}
+	error = flink_write_queue_add(pdata, subdev->base_addr + offset, value, size);
+	if(error) {
+		return error;
+	}
+	flink_register_written(subdev, offset, size, value, flink_cache_generation(subdev));	// readers see the queued value
+	#if defined(DBG)
+		printk(KERN_DEBUG "  -> Queued value:  0x%x", value);
+	#endif
+	return size;
+}
+
+// ############ Burst transfers ############
+
+/**
+ * flink_burst_valid() - checks if a burst transfer fits into a subdevice
+ * @subdev: the subdevice which is accessed
+ * @offset: offset of the first register within the subdevice
+ * @size: number of bytes to transfer
+ *
+ * A burst consists of whole 32 bit registers, so offset and size must be
+ * multiples of 4 and the whole range must lie within the subdevice.
+ */
+static inline bool flink_burst_valid(struct flink_subdevice* subdev, u32 offset, size_t size) {
+	if(size == 0 || (size % sizeof(u32)) != 0 || (offset % sizeof(u32)) != 0) {
+		#if defined(DBG)
+			printk(KERN_DEBUG "  -> Size of transfer not supported: %lu bytes!", (long unsigned int)size);
+		#endif
+		return false;
+	}
+	if(offset > subdev->mem_size || size > subdev->mem_size - offset) {
+		#if defined(DBG)
+			printk(KERN_DEBUG "  -> Burst exceeds subdevice memory: offset 0x%x, %lu bytes", offset, (long unsigned int)size);
+		#endif
+		return false;
+	}
+	return true;
+}
+
+/**
+ * flink_read_burst() - reads a block of 32 bit registers from a subdevice
+ * @fdev: the flink device
+ * @subdev: the subdevice to read from
+ * @offset: offset of the first register within the subdevice
+ * @data: user space buffer
+ * @size: number of bytes to read
+ * @mode: block transfer mode (FLINK_BLOCK_*)
+ *
+ * The registers are collected in a kernel buffer and copied to user space
+ * with a single copy. Returns the number of bytes read or a negative error code.
+ */
+static ssize_t flink_read_burst(struct flink_device* fdev, struct flink_subdevice* subdev, u32 offset, char __user* data, size_t size, u32 mode) {
+	u32* buf;
+	int error;
+	unsigned long rsize;
+	
+	if(!flink_burst_valid(subdev, offset, size)) {
+		return -EINVAL;
+	}
+	buf = kmalloc(size, GFP_KERNEL);
+	if(buf == NULL) {
+		return -ENOMEM;
+	}
+	error = flink_bus_read_block(fdev, subdev->base_addr + offset, buf, size / sizeof(u32), mode);
+	if(error < 0) {
+		kfree(buf);
+		return error;
+	}
+	rsize = copy_to_user(data, buf, size);
+	kfree(buf);
+	if(rsize > 0) {
+		#if defined(DBG)
+			printk(KERN_DEBUG "  -> Copying to user space failed: %lu bytes not copied!", rsize);
+		#endif
+		return -EFAULT;
+	}
+	#if defined(DBG)
+		printk(KERN_DEBUG "  -> Burst of %lu bytes read", (long unsigned int)size);
+	#endif
+	return size;
+}
+
+/**
+ * flink_write_burst() - writes a block of 32 bit registers to a subdevice
+ * @fdev: the flink device
+ * @subdev: the subdevice to write to
+ * @offset: offset of the first register within the subdevice
+ * @data: user space buffer
+ * @size: number of bytes to write
+ * @mode: block transfer mode (FLINK_BLOCK_*)
+ *
+ * Returns the number of bytes written or a negative error code.
+ */
+static ssize_t flink_write_burst(struct flink_device* fdev, struct flink_subdevice* subdev, u32 offset, const char __user* data, size_t size, u32 mode) {
+	u32* buf;
+	u32 generation;
+	int error;
+	
+	if(!flink_burst_valid(subdev, offset, size)) {
+		return -EINVAL;
+	}
+	buf = memdup_user(data, size);
+	if(IS_ERR(buf)) {
+		#if defined(DBG)
+			printk(KERN_DEBUG "  -> Copying from user space failed!");
+		#endif
+		return PTR_ERR(buf);
+	}
+	generation = flink_cache_generation(subdev);
+	error = flink_bus_write_block(fdev, subdev->base_addr + offset, buf, size / sizeof(u32), mode);
+	flink_register_written(subdev, offset, size, buf[0], generation);
+	kfree(buf);
+	if(error < 0) {
+		return error;
+	}
+	#if defined(DBG)
+		printk(KERN_DEBUG "  -> Burst of %lu bytes written", (long unsigned int)size);
+	#endif
+	return size;
+}
+
+// ############ Register access helpers ############
+
+/**
+ * flink_subdevice_accessible() - checks the exclusive ownership of a subdevice
+ * @subdev: the subdevice
+ * @pdata: private data of the accessing file
+ *
+ * A subdevice can be accessed by all files unless another file selected it
+ * exclusively. For the owner this is a single compare, no lock is taken.
+ */
+static inline bool flink_subdevice_accessible(struct flink_subdevice* subdev, struct flink_private_data* pdata) {
+	struct flink_private_data* owner = READ_ONCE(subdev->excl_owner);
+	return likely(owner == NULL || owner == pdata);
+}
+
+/**
+ * flink_release_subdevice() - gives up the exclusive ownership of a file
+ * @pdata: private data of the file
+ */
+static void flink_release_subdevice(struct flink_private_data* pdata) {
+	struct flink_subdevice* subdev = pdata->excl_subdevice;
+	if(subdev != NULL) {
+		cmpxchg(&(subdev->excl_owner), pdata, NULL);
+		pdata->excl_subdevice = NULL;
+		#if defined(DBG)
+			printk(KERN_DEBUG "[%s] Exclusive access to subdevice %u released", MODULE_NAME, subdev->id);
+		#endif
+	}
+}
+
+/**
+ * flink_subdevice_bound_elsewhere() - checks if a subdevice node forbids accessing a subdevice
+ * @pdata: private data of the accessing file
+ * @subdevice: id of the subdevice
+ *
+ * Files opened through a subdevice node (/dev/flinkN.M) may only access their
+ * own subdevice. Returns true if the access must fail with -EPERM.
+ */
+static inline bool flink_subdevice_bound_elsewhere(struct flink_private_data* pdata, u8 subdevice) {
+	if(pdata->fixed_subdevice && pdata->current_subdevice->id != subdevice) {
+		#if defined(DBG)
+			printk(KERN_DEBUG "  -> Subdevice node is bound to subdevice %u", pdata->current_subdevice->id);
+		#endif
+		return true;
+	}
+	return false;
+}
+
+/**
+ * flink_get_register_subdevice() - looks up the subdevice of a register access
+ * @pdata: private data of the accessing file
+ * @subdevice: id of the subdevice
+ * @offset: offset of the register within the subdevice
+ * @size: access size in bytes
+ *
+ * Returns the subdevice, ERR_PTR(-EINVAL) if it does not exist or the register
+ * does not lie within the subdevice, ERR_PTR(-EPERM) if the file is bound to
+ * another subdevice or ERR_PTR(-EBUSY) if another file owns it.
+ */
+static struct flink_subdevice* flink_get_register_subdevice(struct flink_private_data* pdata, u8 subdevice, u32 offset, u32 size) {
+	struct flink_subdevice* subdev;
+	if(flink_subdevice_bound_elsewhere(pdata, subdevice)) {
+		return ERR_PTR(-EPERM);
+	}
+	subdev = flink_get_subdevice_by_id(pdata->fdev, subdevice);
+	if(subdev == NULL || offset > subdev->mem_size || size > subdev->mem_size - offset) {
+		#if defined(DBG)
+			printk(KERN_DEBUG "  -> Illegal register: subdevice %u, offset 0x%x, %u bytes", subdevice, offset, size);
+		#endif
+		return ERR_PTR(-EINVAL);
+	}
+	if(!flink_subdevice_accessible(subdev, pdata)) {
+		#if defined(DBG)
+			printk(KERN_DEBUG "  -> Subdevice %u is owned exclusively by another file", subdevice);
+		#endif
+		return ERR_PTR(-EBUSY);
+	}
+	return subdev;
+}
+
+/**
+ * flink_find_shadow_register() - looks up the shadow of a register
+ * @subdev: the subdevice containing the register
+ * @offset: offset of the register within the subdevice
+ *
+ * Must be called with the rmw_lock of the subdevice held. Returns NULL if
+ * no bits of the register are owned.
+ */
+static struct flink_shadow_register* flink_find_shadow_register(struct flink_subdevice* subdev, u32 offset) {
+	struct flink_shadow_register* reg;
+	list_for_each_entry(reg, &(subdev->shadow_registers), list) {
+		if(reg->offset == offset) {
+			return reg;
+		}
+	}
+	return NULL;
+}
+
+/**
+ * flink_masked_write32() - atomically modifies bits of a register
+ * @subdev: the subdevice containing the register
+ * @offset: offset of the register within the subdevice
+ * @mask: bits to modify
+ * @value: new value of the bits given by mask
+ *
+ * Writes (reg & ~mask) | (value & mask). Read and write are executed under
+ * the read-modify-write lock of the subdevice, so concurrent modifications
+ * of other bits are not lost. Returns the register value before the write.
+ */
+static u32 flink_masked_write32(struct flink_subdevice* subdev, u32 offset, u32 mask, u32 value) {
+	struct flink_device* fdev = subdev->parent;
+	u32 addr = subdev->base_addr + offset;
+	u32 old, generation;
+	mutex_lock(&(subdev->rmw_lock));
+	old = flink_bus_read32(fdev, addr);
+	generation = flink_cache_generation(subdev);
+	flink_bus_write32(fdev, addr, (old & ~mask) | (value & mask));
+	flink_register_written(subdev, offset, sizeof(u32), (old & ~mask) | (value & mask), generation);
+	mutex_unlock(&(subdev->rmw_lock));
+	#if defined(DBG)
+		printk(KERN_DEBUG "  -> Masked write at 0x%x: 0x%x -> 0x%x", addr, old, (old & ~mask) | (value & mask));
+	#endif
+	return old;
+}
+
+/**
+ * flink_compare_and_swap32() - atomically replaces a register value
+ * @subdev: the subdevice containing the register
+ * @offset: offset of the register within the subdevice
+ * @compare: expected register value
+ * @value: new register value
+ *
+ * The value is only written if the register contains compare. Returns the
+ * register value before the operation. The operation is atomic with respect
+ * to all accesses through the flink core which take the read-modify-write lock.
+ */
+static u32 flink_compare_and_swap32(struct flink_subdevice* subdev, u32 offset, u32 compare, u32 value) {
+	struct flink_device* fdev = subdev->parent;
+	u32 addr = subdev->base_addr + offset;
+	u32 old, generation;
+	mutex_lock(&(subdev->rmw_lock));
+	old = flink_bus_read32(fdev, addr);
+	if(old == compare) {
+		generation = flink_cache_generation(subdev);
+		flink_bus_write32(fdev, addr, value);
+		flink_register_written(subdev, offset, sizeof(u32), value, generation);
+	}
+	mutex_unlock(&(subdev->rmw_lock));
+	return old;
+}
+
+/**
+ * flink_fetch_and_add32() - atomically adds to a register
+ * @subdev: the subdevice containing the register
+ * @offset: offset of the register within the subdevice
+ * @value: value to add (wraps around)
+ *
+ * Returns the register value before the addition.
+ */
+static u32 flink_fetch_and_add32(struct flink_subdevice* subdev, u32 offset, u32 value) {
+	struct flink_device* fdev = subdev->parent;
+	u32 addr = subdev->base_addr + offset;
+	u32 old, generation;
+	mutex_lock(&(subdev->rmw_lock));
+	old = flink_bus_read32(fdev, addr);
+	generation = flink_cache_generation(subdev);
+	flink_bus_write32(fdev, addr, old + value);
+	flink_register_written(subdev, offset, sizeof(u32), old + value, generation);
+	mutex_unlock(&(subdev->rmw_lock));
+	return old;
+}
+
+/**
+ * flink_poll_register() - waits until a register matches a value
+ * @fdev: the flink device
+ * @addr: address of the register
+ * @container: poll parameters, last_value and elapsed_ns are filled in
+ *
+ * The register is read once more after the timeout expired, so a condition
+ * which became true while sleeping is not reported as timeout.
+ * Returns 0 on success, -ETIMEDOUT if the condition did not become true or
+ * -EINTR if a signal arrived while sleeping.
+ */
+static int flink_poll_register(struct flink_device* fdev, u32 addr, struct ioctl_poll_container_t* container) {
+	ktime_t start = ktime_get();
+	ktime_t deadline = ktime_add_us(start, container->timeout_us);
+	u64 interval_ns = (u64)(container->interval_us ? container->interval_us : FLINK_POLL_DEFAULT_INTERVAL_US) * NSEC_PER_USEC;
+	int ret = 0;
+	u32 val;
+	
+	for(;;) {
+		val = flink_bus_read32(fdev, addr);
+		if((val & container->mask) == container->value) {
+			break;
+		}
+		if(ktime_after(ktime_get(), deadline)) {
+			val = flink_bus_read32(fdev, addr);
+			if((val & container->mask) != container->value) {
+				ret = -ETIMEDOUT;
+			}
+			break;
+		}
+		if(container->mode == FLINK_POLL_BUSY) {
+			cpu_relax();
+		}
+		else {
+			ktime_t wakeup = ns_to_ktime(interval_ns);
+			set_current_state(TASK_INTERRUPTIBLE);
+			schedule_hrtimeout_range(&wakeup, interval_ns / 4, HRTIMER_MODE_REL);
+			if(signal_pending(current)) {
+				val = flink_bus_read32(fdev, addr);
+				if((val & container->mask) != container->value) {
+					ret = -EINTR;
+				}
+				break;
+			}
+		}
+	}
+	container->last_value = val;
+	container->elapsed_ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+	return ret;
+}
+
+/**
+ * flink_field_mask() - calculates the mask of a bit field
+ * @shift: position of the lowest bit of the field
+ * @width: number of bits of the field
+ *
+ * Returns 0 if the field does not fit into a 32 bit register.
+ */
+static inline u32 flink_field_mask(u8 shift, u8 width) {
+	if(width == 0 || width > 32 || shift > 32 - width) {
+		return 0;
+	}
+	return (width == 32) ? 0xFFFFFFFF : (((1U << width) - 1) << shift);
+}
+
+// ############ Bit ownership ############
+
+static struct flink_bit_claim* flink_find_bit_claim(struct flink_shadow_register* reg, struct flink_private_data* pdata) {
+	struct flink_bit_claim* claim;
+	list_for_each_entry(claim, &(reg->claims), list) {
+		if(claim->owner == pdata) {
+			return claim;
+		}
+	}
+	return NULL;
+}
+
+/**
+ * flink_drop_bit_claim() - gives up bits of a claim
+ * @reg: the shadow register
+ * @claim: the claim of the file
+ * @mask: bits to give up
+ *
+ * Frees the claim when it owns no bits any more and the shadow register when
+ * it has no claims any more. Must be called with the rmw_lock of the subdevice held.
+ */
+static void flink_drop_bit_claim(struct flink_shadow_register* reg, struct flink_bit_claim* claim, u32 mask) {
+	claim->mask &= ~mask;
+	reg->claimed &= ~mask;
+	if(claim->mask == 0) {
+		list_del(&(claim->list));
+		kfree(claim);
+	}
+	if(list_empty(&(reg->claims))) {
+		list_del_rcu(&(reg->list));
+		kfree_rcu(reg, rcu);
+	}
+}
+
+/**
+ * flink_claim_bits() - claims bits of a register for a file
+ * @pdata: private data of the claiming file
+ * @subdev: the subdevice containing the register
+ * @offset: offset of the register within the subdevice
+ * @mask: bits to claim
+ *
+ * The register is read once when its first bits are claimed, afterwards the
+ * kernel keeps a shadow of it. Returns 0, -EBUSY if another file owns one of
+ * the bits or -ENOMEM.
+ */
+static int flink_claim_bits(struct flink_private_data* pdata, struct flink_subdevice* subdev, u32 offset, u32 mask) {
+	struct flink_shadow_register* reg;
+	struct flink_shadow_register* new_reg = kmalloc(sizeof(*new_reg), GFP_KERNEL);
+	struct flink_bit_claim* claim;
+	struct flink_bit_claim* new_claim = kmalloc(sizeof(*new_claim), GFP_KERNEL);
+	int error = 0;
+	
+	if(new_reg == NULL || new_claim == NULL) {
+		kfree(new_reg);
+		kfree(new_claim);
+		return -ENOMEM;
+	}
+	mutex_lock(&(subdev->rmw_lock));
+	reg = flink_find_shadow_register(subdev, offset);
+	claim = (reg != NULL) ? flink_find_bit_claim(reg, pdata) : NULL;
+	if(reg != NULL && (reg->claimed & mask & ~(claim ? claim->mask : 0)) != 0) {
+		#if defined(DBG)
+			printk(KERN_DEBUG "  -> Bits 0x%x are owned by another file", reg->claimed & mask & ~(claim ? claim->mask : 0));
+		#endif
+		error = -EBUSY;
+		goto out;
+	}
+	if(reg == NULL) {
+		reg = new_reg;
+		new_reg = NULL;
+		INIT_LIST_HEAD(&(reg->claims));
+		reg->offset = offset;
+		reg->value = flink_bus_read32(subdev->parent, subdev->base_addr + offset);
+		reg->claimed = 0;
+		reg->stale = false;
+		list_add_tail_rcu(&(reg->list), &(subdev->shadow_registers));
+	}
+	if(claim == NULL) {
+		claim = new_claim;
+		new_claim = NULL;
+		claim->owner = pdata;
+		claim->mask = 0;
+		list_add_tail(&(claim->list), &(reg->claims));
+	}
+	claim->mask |= mask;
+	reg->claimed |= mask;
+	pdata->bit_claims = true;
+out:
+	mutex_unlock(&(subdev->rmw_lock));
+	kfree(new_reg);
+	kfree(new_claim);
+	return error;
+}
+
+/**
+ * flink_release_bits() - gives up bits of a register claimed by a file
+ * @pdata: private data of the file
+ * @subdev: the subdevice containing the register
+ * @offset: offset of the register within the subdevice
+ * @mask: bits to give up, bits not owned by the file are ignored
+ */
+static int flink_release_bits(struct flink_private_data* pdata, struct flink_subdevice* subdev, u32 offset, u32 mask) {
+	struct flink_shadow_register* reg;
+	struct flink_bit_claim* claim = NULL;
+	mutex_lock(&(subdev->rmw_lock));
+	reg = flink_find_shadow_register(subdev, offset);
+	if(reg != NULL) {
+		claim = flink_find_bit_claim(reg, pdata);
+		if(claim != NULL) {
+			flink_drop_bit_claim(reg, claim, mask & claim->mask);
+		}
+	}
+	mutex_unlock(&(subdev->rmw_lock));
+	return (claim != NULL) ? 0 : -EINVAL;
+}
+
+/**
+ * flink_release_all_bits() - gives up all bits claimed by a file
+ * @pdata: private data of the file
+ */
+static void flink_release_all_bits(struct flink_private_data* pdata) {
+	struct flink_subdevice* subdev;
+	struct flink_shadow_register* reg, *reg_next;
+	struct flink_bit_claim* claim;
+	if(!pdata->bit_claims) {
+		return;
+	}
+	list_for_each_entry(subdev, &(pdata->fdev->subdevices), list) {
+		mutex_lock(&(subdev->rmw_lock));
+		list_for_each_entry_safe(reg, reg_next, &(subdev->shadow_registers), list) {
+			claim = flink_find_bit_claim(reg, pdata);
+			if(claim != NULL) {
+				flink_drop_bit_claim(reg, claim, claim->mask);
+			}
+		}
+		mutex_unlock(&(subdev->rmw_lock));
+	}
+	pdata->bit_claims = false;
+}
+
+/**
+ * flink_write_owned_bits() - writes bits owned by a file
+ * @pdata: private data of the file
+ * @subdev: the subdevice containing the register
+ * @offset: offset of the register within the subdevice
+ * @mask: bits to write, must be owned by the file
+ * @value: new value of the bits given by mask
+ * @old_value: returns the shadow value before the write
+ *
+ * The bits are merged into the shadow and the shadow is written with a single
+ * 32 bit write, the register is not read back unless a narrow or block write
+ * made the shadow stale. Returns 0 or -EPERM.
+ */
+static int flink_write_owned_bits(struct flink_private_data* pdata, struct flink_subdevice* subdev, u32 offset, u32 mask, u32 value, u32* old_value) {
+	struct flink_shadow_register* reg;
+	struct flink_bit_claim* claim = NULL;
+	int error = 0;
+	mutex_lock(&(subdev->rmw_lock));
+	reg = flink_find_shadow_register(subdev, offset);
+	if(reg != NULL) {
+		claim = flink_find_bit_claim(reg, pdata);
+	}
+	if(claim == NULL || (mask & ~claim->mask) != 0) {
+		#if defined(DBG)
+			printk(KERN_DEBUG "  -> Bits 0x%x are not owned by this file", mask & ~(claim ? claim->mask : 0));
+		#endif
+		error = -EPERM;
+	}
+	else {
+		if(READ_ONCE(reg->stale)) {
+			WRITE_ONCE(reg->stale, false);
+			WRITE_ONCE(reg->value, flink_bus_read32(subdev->parent, subdev->base_addr + offset));
+		}
+		u32 generation = flink_cache_generation(subdev);
+		*old_value = READ_ONCE(reg->value);
+		value = (*old_value & ~mask) | (value & mask);
+		flink_bus_write32(subdev->parent, subdev->base_addr + offset, value);
+		flink_register_written(subdev, offset, sizeof(u32), value, generation);
+	}
+	mutex_unlock(&(subdev->rmw_lock));
+	return error;
+}
+
+// ############ Batched register accesses ############
+
+/**
+ * flink_execute_batch() - executes a list of register accesses
+ * @pdata: private data of the accessing file
+ * @entries: the register accesses, read values are stored in place
+ * @nof_entries: number of entries
+ *
+ * All entries are checked first, so an invalid entry does not leave the device
+ * with a partially executed batch. Afterwards the accesses are executed in order.
+ * Returns the number of executed entries or a negative error code.
+ */
+static int flink_execute_batch(struct flink_private_data* pdata, struct ioctl_batch_entry_t* entries, u32 nof_entries) {
+	struct flink_device* fdev = pdata->fdev;
+	struct flink_subdevice* subdev;
+	struct ioctl_batch_entry_t* e;
+	u32 i;
+	
+	for(i = 0; i < nof_entries; i++) {
+		e = &entries[i];
+		subdev = flink_get_register_subdevice(pdata, e->subdevice, e->offset, e->size);
+		if(IS_ERR(subdev)) {
+			return PTR_ERR(subdev);
+		}
+		if(e->op > FLINK_BATCH_WRITE || !flink_bus_width_supported(fdev, e->size)) {
+			#if defined(DBG)
+				printk(KERN_DEBUG "  -> Invalid batch entry %u", i);
+			#endif
+			return -EINVAL;
+		}
+	}
+	for(i = 0; i < nof_entries; i++) {
+		u32 addr;
+		e = &entries[i];
+		subdev = flink_get_subdevice_by_id(fdev, e->subdevice);
+		addr = subdev->base_addr + e->offset;
+		if(e->op == FLINK_BATCH_READ) {
+			switch(e->size) {
+				case 1:  e->value = flink_bus_read8(fdev, addr);  break;
+				case 2:  e->value = flink_bus_read16(fdev, addr); break;
+				default: e->value = flink_cache_read32(subdev, e->offset, false); break;
+			}
+		}
+		else {
+			u32 generation = flink_cache_generation(subdev);
+			switch(e->size) {
+				case 1:  flink_bus_write8(fdev, addr, (u8)e->value);   break;
+				case 2:  flink_bus_write16(fdev, addr, (u16)e->value); break;
+				default: flink_bus_write32(fdev, addr, e->value);      break;
+			}
+			flink_register_written(subdev, e->offset, e->size, e->value, generation);
+		}
+	}
+	return nof_entries;
+}
+
+// ############ IRQ lookup ############
+
+/**
+ * flink_get_irq() - looks up the data of an IRQ
+ * @fdev: the device
+ * @irq_nr: IRQ number without offset
+ *
+ * Returns NULL if the device has no such IRQ.
+ */
+static inline struct flink_irq_data* flink_get_irq(struct flink_device* fdev, u32 irq_nr) {
+	if(unlikely(irq_nr >= fdev->nof_irqs || fdev->irqs == NULL)) {
+		return NULL;
+	}
+	return &(fdev->irqs[irq_nr]);
+}
+
+// ############ Micro-sequencer ############
+
+static struct workqueue_struct* flink_seq_wq;
+
+/**
+ * flink_seq_verify() - checks a sequencer program before it is loaded
+ * @pdata: private data of the loading file
+ * @insns: the instructions
+ * @nof_insns: number of instructions
+ *
+ * All registers must lie within their subdevice, jumps must go forward and
+ * the sum of all poll timeouts and delays is limited, so every instruction is
+ * executed at most once and the run time of a program is bounded.
+ * Returns 0 or a negative error code.
+ */
+static int flink_seq_verify(struct flink_private_data* pdata, struct flink_seq_insn_t* insns, u32 nof_insns) {
+	struct flink_subdevice* subdev;
+	u64 time_us = 0;
+	u32 i;
+	for(i = 0; i < nof_insns; i++) {
+		struct flink_seq_insn_t* insn = &insns[i];
+		switch(insn->op) {
+			case FLINK_SEQ_END:
+				break;
+			case FLINK_SEQ_POLL:
+				time_us += insn->param;
+				fallthrough;
+			case FLINK_SEQ_READ:
+			case FLINK_SEQ_WRITE:
+			case FLINK_SEQ_MASKED_WRITE:
+				subdev = flink_get_register_subdevice(pdata, insn->subdevice, insn->offset, sizeof(u32));
+				if(IS_ERR(subdev)) {
+					return PTR_ERR(subdev);
+				}
+				break;
+			case FLINK_SEQ_DELAY:
+				time_us += insn->param;
+				break;
+			case FLINK_SEQ_JUMP_IF:
+				if(insn->target <= i || insn->target > nof_insns) {
+					#if defined(DBG)
+						printk(KERN_DEBUG "  -> Instruction %u: illegal jump target %u", i, insn->target);
+					#endif
+					return -EINVAL;
+				}
+				break;
+			case FLINK_SEQ_STORE:
+				if(insn->target >= FLINK_SEQ_MAX_RESULTS) {
+					return -EINVAL;
+				}
+				break;
+			default:
+				#if defined(DBG)
+					printk(KERN_DEBUG "  -> Instruction %u: unknown opcode %u", i, insn->op);
+				#endif
+				return -EINVAL;
+		}
+	}
+	if(time_us > FLINK_SEQ_MAX_TIME_US) {
+		#if defined(DBG)
+			printk(KERN_DEBUG "  -> Program waits too long: %llu us", (unsigned long long)time_us);
+		#endif
+		return -EINVAL;
+	}
+	return 0;
+}
+
+/**
+ * flink_seq_run() - executes a sequencer program
+ * @prog: the program, prog->lock must be held
+ *
+ * The result slots, status and run counter of the program are updated.
+ * Returns 0 or the error code which stopped the program.
+ */
+static int flink_seq_run(struct flink_program* prog) {
+	struct flink_device* fdev = prog->fdev;
+	struct flink_seq_insn_t* insn;
+	struct flink_subdevice* subdev = NULL;
+	struct ioctl_poll_container_t poll;
+	u32 pc = 0;
+	u32 acc = 0;
+	int ret = 0;
+	
+	memset(prog->results, 0, sizeof(prog->results));
+	while(pc < prog->nof_insns && ret == 0) {
+		insn = &(prog->insns[pc++]);
+		if(insn->op >= FLINK_SEQ_READ && insn->op <= FLINK_SEQ_POLL) {
+			subdev = flink_get_subdevice_by_id(fdev, insn->subdevice);
+			if(!flink_subdevice_accessible(subdev, prog->pdata)) {
+				ret = -EBUSY;
+				break;
+			}
+		}
+		switch(insn->op) {
+			case FLINK_SEQ_END:
+				pc = prog->nof_insns;
+				break;
+			case FLINK_SEQ_READ:
+				acc = flink_cache_read32(subdev, insn->offset, false);
+				break;
+			case FLINK_SEQ_WRITE: {
+				u32 generation = flink_cache_generation(subdev);
+				ret = flink_bus_write32(fdev, subdev->base_addr + insn->offset, insn->value);
+				flink_register_written(subdev, insn->offset, sizeof(u32), insn->value, generation);
+				break;
+			}
+			case FLINK_SEQ_MASKED_WRITE:
+				flink_masked_write32(subdev, insn->offset, insn->mask, insn->value);
+				break;
+			case FLINK_SEQ_POLL:
+				memset(&poll, 0, sizeof(poll));
+				poll.mode = FLINK_POLL_SLEEP;
+				poll.mask = insn->mask;
+				poll.value = insn->value;
+				poll.timeout_us = insn->param;
+				ret = flink_poll_register(fdev, subdev->base_addr + insn->offset, &poll);
+				acc = poll.last_value;
+				break;
+			case FLINK_SEQ_DELAY:
+				fsleep(insn->param);
+				break;
+			case FLINK_SEQ_JUMP_IF:
+				if((acc & insn->mask) == insn->value) {
+					pc = insn->target;
+				}
+				break;
+			case FLINK_SEQ_STORE:
+				prog->results[insn->target] = acc;
+				break;
+		}
+	}
+	#if defined(DBG)
+		if(ret) printk(KERN_DEBUG "[%s] Program stopped at instruction %u: %i", MODULE_NAME, pc - 1, ret);
+	#endif
+	prog->status = ret;
+	prog->nof_runs++;
+	return ret;
+}
+
+static void flink_seq_work(struct work_struct* work) {
+	struct flink_program* prog = container_of(work, struct flink_program, work);
+	mutex_lock(&(prog->lock));
+	flink_seq_run(prog);
+	mutex_unlock(&(prog->lock));
+}
+
+static enum hrtimer_restart flink_seq_timer(struct hrtimer* timer) {
+	struct flink_program* prog = container_of(timer, struct flink_program, timer);
+	queue_work(flink_seq_wq, &(prog->work));
+	hrtimer_forward_now(timer, prog->period);
+	return HRTIMER_RESTART;
+}
+
+/**
+ * flink_seq_detach() - removes the trigger of a program
+ * @prog: the program
+ *
+ * Returns after a run started by the trigger has completed.
+ */
+static void flink_seq_detach(struct flink_program* prog) {
+	switch(prog->trigger) {
+		case FLINK_SEQ_TRIGGER_IRQ:
+			mutex_lock(&(prog->irq->lock_for_ioctl));
+			list_del_rcu(&(prog->irq_node));
+			mutex_unlock(&(prog->irq->lock_for_ioctl));
+			synchronize_rcu();	// the IRQ handler can no longer queue the work
+			prog->irq = NULL;
+			break;
+		case FLINK_SEQ_TRIGGER_TIMER:
+			hrtimer_cancel(&(prog->timer));
+			break;
+	}
+	prog->trigger = FLINK_SEQ_TRIGGER_NONE;
+	cancel_work_sync(&(prog->work));
+}
+
+/**
+ * flink_seq_attach() - lets a program be triggered by an IRQ or a timer
+ * @prog: the program
+ * @trigger: the trigger, replaces the current trigger
+ */
+static int flink_seq_attach(struct flink_program* prog, struct ioctl_trigger_container_t* trigger) {
+	struct flink_irq_data* hwirq;
+	flink_seq_detach(prog);
+	switch(trigger->source) {
+		case FLINK_SEQ_TRIGGER_NONE:
+			return 0;
+		case FLINK_SEQ_TRIGGER_IRQ:
+			hwirq = flink_get_irq(prog->fdev, trigger->irq_nr);
+			if(hwirq == NULL) {
+				return -EINVAL;
+			}
+			prog->irq = hwirq;
+			mutex_lock(&(hwirq->lock_for_ioctl));
+			list_add_tail_rcu(&(prog->irq_node), &(hwirq->programs));
+			mutex_unlock(&(hwirq->lock_for_ioctl));
+			prog->trigger = FLINK_SEQ_TRIGGER_IRQ;
+			return 0;
+		case FLINK_SEQ_TRIGGER_TIMER:
+			if(trigger->period_us < FLINK_SEQ_MIN_PERIOD_US) {
+				return -EINVAL;
+			}
+			prog->period = us_to_ktime(trigger->period_us);
+			prog->trigger = FLINK_SEQ_TRIGGER_TIMER;
+			hrtimer_start(&(prog->timer), prog->period, HRTIMER_MODE_REL);
+			return 0;
+		default:
+			return -EINVAL;
+	}
+}
+
+static void flink_seq_free(struct flink_program* prog) {
+	if(prog != NULL) {
+		flink_seq_detach(prog);
+		kfree(prog);
+	}
+}
+
+/**
+ * flink_seq_load() - verifies a program from user space and installs it for a file
+ * @pdata: private data of the file, a previously loaded program is replaced
+ * @container: the program container
+ */
+static int flink_seq_load(struct flink_private_data* pdata, struct ioctl_program_container_t* container) {
+	struct flink_program* prog;
+	int error;
+	if(container->nof_insns == 0 || container->nof_insns > FLINK_SEQ_MAX_INSNS) {
+		return -EINVAL;
+	}
+	prog = kzalloc(struct_size(prog, insns, container->nof_insns), GFP_KERNEL);
+	if(prog == NULL) {
+		return -ENOMEM;
+	}
+	if(copy_from_user(prog->insns, (void __user *)container->insns, container->nof_insns * sizeof(prog->insns[0])) != 0) {
+		kfree(prog);
+		return -EFAULT;
+	}
+	error = flink_seq_verify(pdata, prog->insns, container->nof_insns);
+	if(error) {
+		kfree(prog);
+		return error;
+	}
+	prog->fdev = pdata->fdev;
+	prog->pdata = pdata;
+	prog->nof_insns = container->nof_insns;
+	mutex_init(&(prog->lock));
+	INIT_WORK(&(prog->work), flink_seq_work);
+	flink_hrtimer_setup(&(prog->timer), flink_seq_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	INIT_LIST_HEAD(&(prog->irq_node));
+	
+	mutex_lock(&(pdata->program_lock));
+	flink_seq_free(pdata->program);
+	pdata->program = prog;
+	mutex_unlock(&(pdata->program_lock));
+	return 0;
+}
+
+// ############ Timed writes ############
+
+static enum hrtimer_restart flink_timed_write_timer(struct hrtimer* timer) {
+	struct flink_timed_writes* tw = container_of(timer, struct flink_timed_writes, timer);
+	struct flink_device* fdev = container_of(tw, struct flink_device, timed_writes);
+	struct flink_timed_write* e;
+	enum hrtimer_restart restart = HRTIMER_NORESTART;
+	unsigned long flags;
+	ktime_t now;
+	
+	raw_spin_lock_irqsave(&(tw->lock), flags);
+	now = ktime_get();
+	while(!list_empty(&(tw->pending))) {
+		e = list_first_entry(&(tw->pending), struct flink_timed_write, list);
+		if(ktime_after(e->time, now)) {
+			hrtimer_set_expires(timer, e->time);
+			restart = HRTIMER_RESTART;
+			break;
+		}
+		fdev->bus_ops->write32(fdev, e->subdev->base_addr + e->offset, e->value);
+		now = ktime_get();
+		e->executed = now;
+		e->written = true;
+		list_move_tail(&(e->list), &(tw->executed));
+	}
+	if(!list_empty(&(tw->executed))) {
+		queue_work(system_highpri_wq, &(tw->work));
+	}
+	raw_spin_unlock_irqrestore(&(tw->lock), flags);
+	return restart;
+}
+
+static void flink_timed_write_work(struct work_struct* work) {
+	struct flink_timed_writes* tw = container_of(work, struct flink_timed_writes, work);
+	struct flink_device* fdev = container_of(tw, struct flink_device, timed_writes);
+	struct flink_timed_write* e, *e_next;
+	LIST_HEAD(executed);
+	
+	raw_spin_lock_irq(&(tw->lock));
+	list_splice_init(&(tw->executed), &executed);
+	raw_spin_unlock_irq(&(tw->lock));
+	
+	// The timer wrote the bus directly, update what the dispatch layer would have updated
+	list_for_each_entry(e, &executed, list) {
+		flink_register_written(e->subdev, e->offset, sizeof(u32), e->value, e->generation);
+		if(flink_coalescing(fdev)) {
+			flink_coalesce_invalidate(fdev, e->subdev->base_addr + e->offset, sizeof(u32));
+		}
+	}
+	
+	raw_spin_lock_irq(&(tw->lock));
+	list_for_each_entry_safe(e, e_next, &executed, list) {
+		list_del_init(&(e->list));
+		e->done = true;
+	}
+	raw_spin_unlock_irq(&(tw->lock));
+	wake_up_all(&(tw->wait));
+}
+
+static void flink_timed_write_init(struct flink_timed_writes* tw) {
+	raw_spin_lock_init(&(tw->lock));
+	flink_hrtimer_setup(&(tw->timer), flink_timed_write_timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS_HARD);
+	INIT_LIST_HEAD(&(tw->pending));
+	INIT_LIST_HEAD(&(tw->executed));
+	INIT_WORK(&(tw->work), flink_timed_write_work);
+	init_waitqueue_head(&(tw->wait));
+	tw->next_id = 1;
+}
+
+/**
+ * flink_timed_write_submit() - schedules a 32 bit register write at an absolute time
+ * @pdata: private data of the submitting file
+ * @container: the write, container->id is filled in
+ *
+ * The write is executed by a hard interrupt hrtimer, so only buses whose
+ * accesses do not sleep are supported. Times in the past are executed
+ * immediately. Returns 0 or a negative error code.
+ */
+static int flink_timed_write_submit(struct flink_private_data* pdata, struct ioctl_timed_write_container_t* container) {
+	struct flink_timed_writes* tw = &(pdata->fdev->timed_writes);
+	struct flink_timed_write* e;
+	struct flink_timed_write* pos;
+	struct flink_subdevice* subdev;
+	ktime_t time = ns_to_ktime(container->time_ns);
+	
+	if(!(pdata->fdev->bus_ops->caps & FLINK_CAP_ATOMIC)) {
+		#if defined(DBG)
+			printk(KERN_DEBUG "  -> Timed writes need a bus which can be accessed in interrupt context");
+		#endif
+		return -EOPNOTSUPP;
+	}
+	if(container->clock == FLINK_CLOCK_TAI) {
+		time = ktime_sub(time, ktime_mono_to_any(0, TK_OFFS_TAI));
+	}
+	else if(container->clock != FLINK_CLOCK_MONOTONIC) {
+		return -EINVAL;
+	}
+	subdev = flink_get_register_subdevice(pdata, container->subdevice, container->offset, sizeof(u32));
+	if(IS_ERR(subdev)) {
+		return PTR_ERR(subdev);
+	}
+	if(READ_ONCE(pdata->nof_timed_writes) >= MAX_TIMED_WRITES_PER_FILE) {
+		return -EAGAIN;
+	}
+	e = kzalloc(sizeof(*e), GFP_KERNEL);
+	if(e == NULL) {
+		return -ENOMEM;
+	}
+	e->subdev = subdev;
+	e->offset = container->offset;
+	e->value = container->value;
+	e->generation = flink_cache_generation(subdev);	// writes until the timer fires invalidate the register
+	e->time = time;
+	e->clock = container->clock;
+	
+	raw_spin_lock_irq(&(tw->lock));
+	e->id = tw->next_id++;
+	list_for_each_entry(pos, &(tw->pending), list) {
+		if(ktime_before(time, pos->time)) {
+			break;
+		}
+	}
+	list_add_tail(&(e->list), &(pos->list));	// insert before the first later write
+	list_add_tail(&(e->file_node), &(pdata->timed_writes));
+	pdata->nof_timed_writes++;
+	if(list_first_entry(&(tw->pending), struct flink_timed_write, list) == e) {
+		hrtimer_start(&(tw->timer), time, HRTIMER_MODE_ABS_HARD);
+	}
+	raw_spin_unlock_irq(&(tw->lock));
+	
+	container->id = e->id;
+	#if defined(DBG)
+		printk(KERN_DEBUG "  -> Timed write %llu at %lld ns queued", (unsigned long long)e->id, (long long)ktime_to_ns(time));
+	#endif
+	return 0;
+}
+
+static bool flink_timed_write_done(struct flink_timed_writes* tw, struct flink_timed_write* e) {
+	bool done;
+	raw_spin_lock_irq(&(tw->lock));
+	done = e->done;
+	raw_spin_unlock_irq(&(tw->lock));
+	return done;
+}
 
-static LIST_HEAD(device_list);
-static LIST_HEAD(loaded_if_modules);
-static struct class* sysfs_class;
+/**
+ * flink_timed_write_result() - waits for a timed write and reports its execution time
+ * @pdata: private data of the file which submitted the write
+ * @result: result->id selects the write, the execution time is filled in
+ *
+ * The write is forgotten afterwards. Returns 0, -EINVAL for an unknown id or
+ * -ERESTARTSYS if a signal arrived while waiting.
+ */
+static int flink_timed_write_result(struct flink_private_data* pdata, struct ioctl_timed_write_result_t* result) {
+	struct flink_timed_writes* tw = &(pdata->fdev->timed_writes);
+	struct flink_timed_write* e = NULL;
+	struct flink_timed_write* pos;
+	ktime_t executed;
+	int error;
+	
+	// Take the write out of the file list, so no other thread waits for it
+	raw_spin_lock_irq(&(tw->lock));
+	list_for_each_entry(pos, &(pdata->timed_writes), file_node) {
+		if(pos->id == result->id) {
+			e = pos;
+			list_del_init(&(e->file_node));
+			break;
+		}
+	}
+	raw_spin_unlock_irq(&(tw->lock));
+	if(e == NULL) {
+		return -EINVAL;
+	}
+	error = wait_event_interruptible(tw->wait, flink_timed_write_done(tw, e));
+	if(error) {
+		raw_spin_lock_irq(&(tw->lock));
+		list_add_tail(&(e->file_node), &(pdata->timed_writes));
+		raw_spin_unlock_irq(&(tw->lock));
+		return error;
+	}
+	executed = e->executed;
+	result->lateness_ns = ktime_to_ns(ktime_sub(executed, e->time));
+	if(e->clock == FLINK_CLOCK_TAI) {
+		executed = ktime_mono_to_any(executed, TK_OFFS_TAI);
+	}
+	result->executed_ns = ktime_to_ns(executed);
+	
+	raw_spin_lock_irq(&(tw->lock));
+	pdata->nof_timed_writes--;
+	raw_spin_unlock_irq(&(tw->lock));
+	kfree(e);
+	return 0;
+}
 
-// ###### Internal Function Prototypes ######
-// do NOT call this directly!!! this function is called over an irq number
-static irqreturn_t flink_threaded_irq_handler(int irq, void *dev_id);
+/**
+ * flink_timed_write_release() - cancels and frees the timed writes of a file
+ * @pdata: private data of the file
+ */
+static void flink_timed_write_release(struct flink_private_data* pdata) {
+	struct flink_timed_writes* tw = &(pdata->fdev->timed_writes);
+	struct flink_timed_write* e, *e_next;
+	
+	if(list_empty(&(pdata->timed_writes))) {
+		return;
+	}
+	raw_spin_lock_irq(&(tw->lock));
+	list_for_each_entry(e, &(pdata->timed_writes), file_node) {
+		if(!e->written) {
+			list_del_init(&(e->list));
+		}
+	}
+	raw_spin_unlock_irq(&(tw->lock));
+	
+	// Writes already executed by the timer are still referenced by the completion work
+	flush_work(&(tw->work));
+	list_for_each_entry_safe(e, e_next, &(pdata->timed_writes), file_node) {
+		kfree(e);
+	}
+	INIT_LIST_HEAD(&(pdata->timed_writes));
+	pdata->nof_timed_writes = 0;
+}
+
+// ############ IRQ notification ############
+
+static void flink_free_irq_eventfd(struct rcu_head* rcu) {
+	struct flink_irq_eventfd* efd = container_of(rcu, struct flink_irq_eventfd, rcu);
+	eventfd_ctx_put(efd->ctx);
+	kfree(efd);
+}
+
+/**
+ * flink_unbind_irq_eventfd() - removes the eventfd a file bound to an IRQ
+ * @pdata: private data of the file
+ * @hwirq: the IRQ
+ *
+ * Returns 0 or -ENOENT if the file did not bind an eventfd to the IRQ.
+ */
+static int flink_unbind_irq_eventfd(struct flink_private_data* pdata, struct flink_irq_data* hwirq) {
+	struct flink_irq_eventfd* efd;
+	struct flink_irq_eventfd* found = NULL;
+	mutex_lock(&(hwirq->lock_for_ioctl));
+	list_for_each_entry(efd, &(hwirq->eventfds), list) {
+		if(efd->owner == pdata) {
+			found = efd;
+			list_del_rcu(&(found->list));
+			break;
+		}
+	}
+	mutex_unlock(&(hwirq->lock_for_ioctl));
+	if(found == NULL) {
+		return -ENOENT;
+	}
+	call_rcu(&(found->rcu), flink_free_irq_eventfd);
+	return 0;
+}
+
+/**
+ * flink_bind_irq_eventfd() - lets an IRQ signal an eventfd
+ * @pdata: private data of the binding file
+ * @hwirq: the IRQ
+ * @fd: the eventfd, replaces an eventfd bound before by the same file
+ *
+ * The eventfd counter is incremented once per IRQ. Returns 0 or a negative error code.
+ */
+static int flink_bind_irq_eventfd(struct flink_private_data* pdata, struct flink_irq_data* hwirq, int fd) {
+	struct flink_irq_eventfd* efd;
+	struct eventfd_ctx* ctx = eventfd_ctx_fdget(fd);
+	if(IS_ERR(ctx)) {
+		return PTR_ERR(ctx);
+	}
+	efd = kzalloc(sizeof(*efd), GFP_KERNEL);
+	if(efd == NULL) {
+		eventfd_ctx_put(ctx);
+		return -ENOMEM;
+	}
+	efd->ctx = ctx;
+	efd->owner = pdata;
+	flink_unbind_irq_eventfd(pdata, hwirq);
+	mutex_lock(&(hwirq->lock_for_ioctl));
+	list_add_tail_rcu(&(efd->list), &(hwirq->eventfds));
+	mutex_unlock(&(hwirq->lock_for_ioctl));
+	pdata->irq_eventfds = true;
+	return 0;
+}
+
+/**
+ * flink_release_irq_eventfds() - removes all eventfds bound by a file
+ * @pdata: private data of the file
+ */
+static void flink_release_irq_eventfds(struct flink_private_data* pdata) {
+	if(!pdata->irq_eventfds) {
+		return;
+	}
+	for(u32 i = 0; i < pdata->fdev->nof_irqs; i++) {
+		flink_unbind_irq_eventfd(pdata, &(pdata->fdev->irqs[i]));
+	}
+	pdata->irq_eventfds = false;
+}
+
+/**
+ * flink_subscribe_irq() - delivers the events of an IRQ to the event queue of a file
+ * @pdata: private data of the subscribing file, the file is switched to event mode
+ * @hwirq: the IRQ
+ *
+ * Returns 0, -EALREADY if the file already subscribed the IRQ or -ENOMEM.
+ */
+static int flink_subscribe_irq(struct flink_private_data* pdata, struct flink_irq_data* hwirq) {
+	struct flink_event_queue* q;
+	struct flink_irq_subscriber* sub;
+	
+	mutex_lock(&(pdata->events_lock));
+	q = pdata->events;
+	if(q == NULL) {
+		q = kzalloc(sizeof(*q), GFP_KERNEL);
+		if(q == NULL) {
+			mutex_unlock(&(pdata->events_lock));
+			return -ENOMEM;
+		}
+		spin_lock_init(&(q->lock));
+		INIT_KFIFO(q->fifo);
+		init_waitqueue_head(&(q->wait));
+		mutex_init(&(q->read_lock));
+		smp_store_release(&(pdata->events), q);	// read() and poll() look at the queue without the lock
+	}
+	mutex_unlock(&(pdata->events_lock));
+	
+	sub = kzalloc(sizeof(*sub), GFP_KERNEL);
+	if(sub == NULL) {
+		return -ENOMEM;
+	}
+	sub->queue = q;
+	mutex_lock(&(hwirq->lock_for_ioctl));
+	{
+		struct flink_irq_subscriber* pos;
+		list_for_each_entry(pos, &(hwirq->subscribers), list) {
+			if(pos->queue == q) {
+				mutex_unlock(&(hwirq->lock_for_ioctl));
+				kfree(sub);
+				return -EALREADY;
+			}
+		}
+	}
+	list_add_tail_rcu(&(sub->list), &(hwirq->subscribers));
+	mutex_unlock(&(hwirq->lock_for_ioctl));
+	return 0;
+}
+
+/**
+ * flink_unsubscribe_irq() - stops delivering the events of an IRQ to a file
+ * @pdata: private data of the file
+ * @hwirq: the IRQ
+ *
+ * Events already queued stay readable. Returns 0 or -ENOENT.
+ */
+static int flink_unsubscribe_irq(struct flink_private_data* pdata, struct flink_irq_data* hwirq) {
+	struct flink_irq_subscriber* sub;
+	struct flink_irq_subscriber* found = NULL;
+	if(pdata->events == NULL) {
+		return -ENOENT;
+	}
+	mutex_lock(&(hwirq->lock_for_ioctl));
+	list_for_each_entry(sub, &(hwirq->subscribers), list) {
+		if(sub->queue == pdata->events) {
+			found = sub;
+			list_del_rcu(&(found->list));
+			break;
+		}
+	}
+	mutex_unlock(&(hwirq->lock_for_ioctl));
+	if(found == NULL) {
+		return -ENOENT;
+	}
+	kfree_rcu(found, rcu);
+	return 0;
+}
+
+/**
+ * flink_release_events() - removes all IRQ subscriptions of a file and frees its event queue
+ * @pdata: private data of the file
+ */
+static void flink_release_events(struct flink_private_data* pdata) {
+	if(pdata->events == NULL) {
+		return;
+	}
+	for(u32 i = 0; i < pdata->fdev->nof_irqs; i++) {
+		flink_unsubscribe_irq(pdata, &(pdata->fdev->irqs[i]));
+	}
+	kfree_rcu(pdata->events, rcu);	// handlers which still see a subscription may fill the queue until the grace period ends
+	pdata->events = NULL;
+}
+
+/**
+ * flink_read_events() - drains IRQ events of a file in event mode
+ * @q: the event queue of the file
+ * @f: the file, blocks unless opened with O_NONBLOCK
+ * @data: user space buffer for struct flink_irq_event_t records
+ * @size: size of the buffer, at least one record
+ *
+ * A blocking read waits again if a concurrent reader drained the queue first,
+ * so it never returns 0. Returns the number of bytes read or a negative error code.
+ */
+static ssize_t flink_read_events(struct flink_event_queue* q, struct file* f, char __user* data, size_t size) {
+	unsigned int copied = 0;
+	int error;
+	
+	if(size < sizeof(struct flink_irq_event_t)) {
+		return -EINVAL;
+	}
+	while(copied == 0) {
+		if(kfifo_is_empty(&(q->fifo))) {
+			if(f->f_flags & O_NONBLOCK) {
+				return -EAGAIN;
+			}
+			error = wait_event_interruptible(q->wait, !kfifo_is_empty(&(q->fifo)));
+			if(error) {
+				return error;
+			}
+		}
+		mutex_lock(&(q->read_lock));
+		error = kfifo_to_user(&(q->fifo), data, rounddown(size, sizeof(struct flink_irq_event_t)), &copied);
+		mutex_unlock(&(q->read_lock));
+		if(error) {
+			return error;
+		}
+	}
+	#if defined(DBG)
+		printk(KERN_DEBUG "  -> %u bytes of IRQ events read", copied);
+	#endif
+	return copied;
+}
+
+// ############ io_uring passthrough ############
+#if defined(FLINK_URING_CMD)
+
+static struct workqueue_struct* flink_uring_wq;
+
+/// @brief An asynchronous register access submitted with IORING_OP_URING_CMD
+struct flink_uring_request {
+	struct work_struct work;
+	struct io_uring_cmd* ioucmd;
+	struct flink_private_data* pdata;
+	u32 cmd_op;
+	void __user* result;					// user space destination of read values
+	struct ioctl_batch_entry_t single;		// entry used for single reads and writes
+	struct ioctl_batch_entry_t* entries;
+	u32 nof_entries;
+	int ret;
+};
+
+static inline struct flink_uring_request** flink_uring_pdu(struct io_uring_cmd* ioucmd) {
+	BUILD_BUG_ON(sizeof(struct flink_uring_request*) > sizeof(ioucmd->pdu));
+	return (struct flink_uring_request**)ioucmd->pdu;
+}
+
+/**
+ * flink_uring_complete() - completes a request in the context of the submitting task
+ * @ioucmd: the io_uring command
+ * @issue_flags: io_uring issue flags
+ *
+ * Copies the read values to user space and posts the completion queue entry.
+ * The result of the CQE is 0 or the number of executed batch entries on success,
+ * a single read additionally returns the value in the second result (CQE32 rings).
+ */
+static void flink_uring_complete(struct io_uring_cmd* ioucmd, unsigned int issue_flags) {
+	struct flink_uring_request* req = *flink_uring_pdu(ioucmd);
+	ssize_t ret = req->ret;
+	ssize_t res2 = 0;
+	
+	if(ret > 0) {
+		switch(req->cmd_op) {
+			case FLINK_URING_READ:
+				res2 = req->single.value;
+				ret = put_user(req->single.value, (u32 __user *)req->result) ? -EFAULT : 0;
+				break;
+			case FLINK_URING_WRITE:
+				ret = 0;
+				break;
+			default:
+				if(copy_to_user(req->result, req->entries, req->nof_entries * sizeof(*req->entries)) != 0) {
+					ret = -EFAULT;
+				}
+				break;
+		}
+	}
+	if(req->entries != &req->single) {
+		kfree(req->entries);
+	}
+	kfree(req);
+	io_uring_cmd_done(ioucmd, ret, res2, issue_flags);
+}
+
+// Since 6.15 the task work callback of io_uring_cmd_complete_in_task() (io_uring_cmd_tw_t)
+// gets an io_tw_token_t instead of the issue flags
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,15,0)
+#ifndef IO_URING_CMD_TASK_WORK_ISSUE_FLAGS
+#define IO_URING_CMD_TASK_WORK_ISSUE_FLAGS IO_URING_F_COMPLETE_DEFER
+#endif
+static void flink_uring_complete_tw(struct io_uring_cmd* ioucmd, io_tw_token_t tw) {
+	flink_uring_complete(ioucmd, IO_URING_CMD_TASK_WORK_ISSUE_FLAGS);
+}
+#else
+#define flink_uring_complete_tw flink_uring_complete
+#endif
+
+static void flink_uring_work(struct work_struct* work) {
+	struct flink_uring_request* req = container_of(work, struct flink_uring_request, work);
+	req->ret = flink_execute_batch(req->pdata, req->entries, req->nof_entries);
+	io_uring_cmd_complete_in_task(req->ioucmd, flink_uring_complete_tw);
+}
+
+/**
+ * flink_uring_cmd() - submits an asynchronous register access
+ * @ioucmd: the io_uring command, the payload is a struct flink_uring_cmd_t
+ * @issue_flags: io_uring issue flags
+ *
+ * The user space data is copied at submission time, the bus accesses are
+ * executed on a workqueue so slow buses (SPI) do not block the submitter.
+ * Returns -EIOCBQUEUED or a negative error code.
+ */
+static int flink_uring_cmd(struct io_uring_cmd* ioucmd, unsigned int issue_flags) {
+	struct flink_private_data* pdata = (struct flink_private_data*)(ioucmd->file->private_data);
+	const struct flink_uring_cmd_t* cmd = io_uring_sqe_cmd(ioucmd->sqe);
+	struct ioctl_batch_container_t batch_container;
+	struct flink_uring_request* req;
+	u64 data = READ_ONCE(cmd->data);
+	
+	if(ioucmd->cmd_op != FLINK_URING_READ && ioucmd->cmd_op != FLINK_URING_WRITE && ioucmd->cmd_op != FLINK_URING_BATCH) {
+		return -EOPNOTSUPP;
+	}
+	req = kzalloc(sizeof(*req), GFP_KERNEL);
+	if(req == NULL) {
+		return -ENOMEM;
+	}
+	req->ioucmd = ioucmd;
+	req->pdata = pdata;
+	req->cmd_op = ioucmd->cmd_op;
+	if(req->cmd_op == FLINK_URING_BATCH) {
+		req->result = u64_to_user_ptr(data);
+		if(copy_from_user(&batch_container, req->result, sizeof(batch_container)) != 0) {
+			kfree(req);
+			return -EFAULT;
+		}
+		if(batch_container.nof_entries == 0 || batch_container.nof_entries > MAX_BATCH_ENTRIES) {
+			kfree(req);
+			return -EINVAL;
+		}
+		req->result = (void __user *)batch_container.entries;
+		req->nof_entries = batch_container.nof_entries;
+		req->entries = memdup_user(req->result, req->nof_entries * sizeof(*req->entries));
+		if(IS_ERR(req->entries)) {
+			int error = PTR_ERR(req->entries);
+			kfree(req);
+			return error;
+		}
+	}
+	else {
+		req->single.subdevice = READ_ONCE(cmd->subdevice);
+		req->single.size = READ_ONCE(cmd->size);
+		req->single.offset = READ_ONCE(cmd->offset);
+		if(req->cmd_op == FLINK_URING_READ) {
+			req->single.op = FLINK_BATCH_READ;
+			req->result = u64_to_user_ptr(data);
+		}
+		else {
+			req->single.op = FLINK_BATCH_WRITE;
+			req->single.value = (u32)data;
+		}
+		req->entries = &req->single;
+		req->nof_entries = 1;
+	}
+	#if defined(DBG)
+		printk(KERN_DEBUG "[%s] uring_cmd 0x%x with %u entries queued", MODULE_NAME, req->cmd_op, req->nof_entries);
+	#endif
+	*flink_uring_pdu(ioucmd) = req;
+	INIT_WORK(&req->work, flink_uring_work);
+	queue_work(flink_uring_wq, &req->work);
+	return -EIOCBQUEUED;
+}
+
+#endif // FLINK_URING_CMD
 
 // ############ File operations ############
 
 int flink_open(struct inode* i, struct file* f) {
 	struct flink_device* fdev = flink_get_device_by_cdev(i->i_cdev);
-	struct flink_private_data* p_data = kmalloc(sizeof(struct flink_private_data), GFP_KERNEL);
+	struct flink_private_data* p_data;
+	unsigned int node;
+	
+	if(fdev == NULL) {
+		return -ENODEV;
+	}
+	p_data = kmalloc(sizeof(struct flink_private_data), GFP_KERNEL);
+	if(p_data == NULL) {
+		return -ENOMEM;
+	}
 	memset(p_data, 0, sizeof(*p_data));
-	p_data->fdev = fdev;
+	p_data->fdev = fdev;	// referenced below, the open inode keeps the device alive until then
+	mutex_init(&(p_data->program_lock));
+	mutex_init(&(p_data->events_lock));
+	INIT_LIST_HEAD(&(p_data->timed_writes));
+	
+	// minor 0 is the device node, minor n+1 the node of subdevice n
+	node = iminor(i) - MINOR(fdev->char_device.dev);
+	if(node > 0) {
+		p_data->current_subdevice = flink_get_subdevice_by_id(fdev, node - 1);
+		if(p_data->current_subdevice == NULL) {
+			kfree(p_data);
+			return -ENODEV;
+		}
+		p_data->fixed_subdevice = true;
+	}
+	kref_get(&(fdev->refcount));
 	f->private_data = p_data;
 	#if defined(DBG)
-		printk(KERN_DEBUG "[%s] Device node opened.", MODULE_NAME);
+		if(node > 0) printk(KERN_DEBUG "[%s] Subdevice node %u.%u opened.", MODULE_NAME, fdev->id, node - 1);
+		else printk(KERN_DEBUG "[%s] Device node opened.", MODULE_NAME);
 	#endif
 	return 0;
 }
 
 int flink_relase(struct inode* i, struct file* f) {
+	struct flink_private_data* pdata = (struct flink_private_data*)(f->private_data);
+	if(pdata != NULL && pdata->write_behind) {
+		flink_write_queue_wait(pdata->fdev);
+	}
+	if(pdata != NULL) {
+		flink_release_subdevice(pdata);
+		flink_release_all_bits(pdata);
+		flink_seq_free(pdata->program);
+		flink_timed_write_release(pdata);
+		flink_release_irq_eventfds(pdata);
+		flink_release_events(pdata);
+		flink_device_put(pdata->fdev);
+	}
 	kfree(f->private_data);
 	#if defined(DBG)
 		printk(KERN_DEBUG "[%s] Device node closed.", MODULE_NAME);
@@ -85,9 +2396,13 @@ int flink_relase(struct inode* i, struct file* f) {
 
 ssize_t flink_read(struct file* f, char __user* data, size_t size, loff_t* offset) {
 	struct flink_private_data* pdata = (struct flink_private_data*)(f->private_data);
+	struct flink_event_queue* events = (pdata != NULL) ? smp_load_acquire(&(pdata->events)) : NULL;
 	#if defined(DBG)
 		printk(KERN_DEBUG "[%s] Reading from device...", MODULE_NAME);
 	#endif
+	if(events != NULL) {
+		return flink_read_events(events, f, data, size);
+	}
 	if(pdata != NULL && pdata->current_subdevice != NULL) {
 		struct flink_subdevice* subdev = pdata->current_subdevice;
 		struct flink_device* fdev = subdev->parent;
@@ -101,10 +2416,22 @@ ssize_t flink_read(struct file* f, char __user* data, size_t size, loff_t* offse
 		if(roffset > subdev->mem_size) {
 			return 0;
 		}
+		if(!flink_subdevice_accessible(subdev, pdata)) {
+			return -EBUSY;
+		}
+		if(pdata->write_behind) {
+			flink_write_queue_wait(fdev);	// reads see the queued writes of this file
+		}
+		if((size == 1 || size == 2 || size == 4) && !flink_bus_width_supported(fdev, size)) {
+			#if defined(DBG)
+				printk(KERN_DEBUG "  -> Access size not supported by the bus: %lu bytes", (long unsigned int)size);
+			#endif
+			return -EOPNOTSUPP;
+		}
 		switch(size) {
 			case 1: {
 				u8 rdata = 0;
-				rdata = fdev->bus_ops->read8(fdev, subdev->base_addr + roffset);
+				rdata = flink_bus_read8(fdev, subdev->base_addr + roffset);
 				rsize = copy_to_user(data, &rdata, sizeof(rdata));
 				if(rsize > 0) {
 					#if defined(DBG)
@@ -119,7 +2446,7 @@ ssize_t flink_read(struct file* f, char __user* data, size_t size, loff_t* offse
 			}
 			case 2: {
 				u16 rdata = 0;
-				rdata = fdev->bus_ops->read16(fdev, subdev->base_addr + roffset);
+				rdata = flink_bus_read16(fdev, subdev->base_addr + roffset);
 				rsize = copy_to_user(data, &rdata, sizeof(rdata));
 				if(rsize > 0) {
 					#if defined(DBG)
@@ -134,7 +2461,7 @@ ssize_t flink_read(struct file* f, char __user* data, size_t size, loff_t* offse
 			}
 			case 4: {
 				u32 rdata = 0;
-				rdata = fdev->bus_ops->read32(fdev, subdev->base_addr + roffset);
+				rdata = flink_cache_read32(subdev, roffset, pdata->relaxed);
 				rsize = copy_to_user(data, &rdata, sizeof(rdata));
 				if(rsize > 0) {
 					#if defined(DBG)
@@ -148,10 +2475,7 @@ ssize_t flink_read(struct file* f, char __user* data, size_t size, loff_t* offse
 				return sizeof(rdata);
 			}
 			default:
-				#if defined(DBG)
-					printk(KERN_DEBUG "  -> Size of transfer not supported: %lu bytes!", (long unsigned int)size);
-				#endif
-				return 0;
+				return flink_read_burst(fdev, subdev, roffset, data, size, FLINK_BLOCK_INCREMENT | (pdata->relaxed ? FLINK_BLOCK_RELAXED : 0));
 		}
 	}
 	return 0;
@@ -175,9 +2499,28 @@ ssize_t flink_write(struct file* f, const char __user* data, size_t size, loff_t
 		if(woffset > subdev->mem_size) {
 			return 0;
 		}
+		if(!flink_subdevice_accessible(subdev, pdata)) {
+			return -EBUSY;
+		}
+		if((size == 1 || size == 2 || size == 4) && !flink_bus_width_supported(fdev, size)) {
+			#if defined(DBG)
+				printk(KERN_DEBUG "  -> Access size not supported by the bus: %lu bytes", (long unsigned int)size);
+			#endif
+			return -EOPNOTSUPP;
+		}
+		if(pdata->write_behind) {
+			if(size == 1 || size == 2 || size == 4) {
+				if(woffset + size > subdev->mem_size) {
+					return -EINVAL;
+				}
+				return flink_write_behind(pdata, subdev, woffset, data, size);
+			}
+			flink_write_queue_wait(fdev);	// bursts are written after the queued writes
+		}
 		switch(size) {
 			case 1: {
 			  	u8 wdata = 0;
+				u32 generation;
 				wsize = copy_from_user(&wdata, data, sizeof(wdata));
 				if(wsize > 0) {
 					#if defined(DBG)
@@ -185,7 +2528,9 @@ ssize_t flink_write(struct file* f, const char __user* data, size_t size, loff_t
 					#endif
 					return 0;
 				}
-				fdev->bus_ops->write8(fdev, subdev->base_addr + woffset, wdata);
+				generation = flink_cache_generation(subdev);
+				flink_bus_write8(fdev, subdev->base_addr + woffset, wdata);
+				flink_register_written(subdev, woffset, sizeof(wdata), wdata, generation);
 				#if defined(DBG)
 					printk(KERN_DEBUG "  -> Value:  0x%x", wdata);
 				#endif
@@ -193,6 +2538,7 @@ ssize_t flink_write(struct file* f, const char __user* data, size_t size, loff_t
 			}
 			case 2: {
 			  	u16 wdata = 0;
+				u32 generation;
 				wsize = copy_from_user(&wdata, data, sizeof(wdata));
 				if(wsize > 0) {
 					#if defined(DBG)
@@ -200,7 +2546,9 @@ ssize_t flink_write(struct file* f, const char __user* data, size_t size, loff_t
 					#endif
 					return 0;
 				}
-				fdev->bus_ops->write16(fdev, subdev->base_addr + woffset, wdata);
+				generation = flink_cache_generation(subdev);
+				flink_bus_write16(fdev, subdev->base_addr + woffset, wdata);
+				flink_register_written(subdev, woffset, sizeof(wdata), wdata, generation);
 				#if defined(DBG)
 					printk(KERN_DEBUG "  -> Value:  0x%x", wdata);
 				#endif
@@ -208,6 +2556,7 @@ ssize_t flink_write(struct file* f, const char __user* data, size_t size, loff_t
 			}
 			case 4: {
 			  	u32 wdata = 0;
+				u32 generation;
 				wsize = copy_from_user(&wdata, data, sizeof(wdata));
 				if(wsize > 0) {
 					#if defined(DBG)
@@ -215,22 +2564,375 @@ ssize_t flink_write(struct file* f, const char __user* data, size_t size, loff_t
 					#endif
 					return 0;
 				}
-				fdev->bus_ops->write32(fdev, subdev->base_addr + woffset, wdata);
+				generation = flink_cache_generation(subdev);
+				flink_bus_write32_mode(fdev, subdev->base_addr + woffset, wdata, pdata->relaxed);
+				flink_register_written(subdev, woffset, sizeof(wdata), wdata, generation);
 				#if defined(DBG)
 					printk(KERN_DEBUG "  -> Value:  0x%x", wdata);
 				#endif
 				return sizeof(wdata);
 			}
 			default:
-				#if defined(DBG)
-					printk(KERN_DEBUG "  -> Size of transfer not supported: %lu bytes!", (long unsigned int)size);
-				#endif
-				return 0;
+				return flink_write_burst(fdev, subdev, woffset, data, size, FLINK_BLOCK_INCREMENT | (pdata->relaxed ? FLINK_BLOCK_RELAXED : 0));
+		}
+	}
+	return 0;
+}
+
+/**
+ * flink_ioctl_masked_write() - handles MASKED_WRITE
+ * @pdata: private data of the calling file
+ * @arg: user space pointer to a struct ioctl_mask_container_t, old_value is returned in it
+ */
+static long flink_ioctl_masked_write(struct flink_private_data* pdata, unsigned long arg) {
+	struct ioctl_mask_container_t container;
+	struct flink_subdevice* subdev;
+	if(copy_from_user(&container, (void __user *)arg, sizeof(container)) != 0) {
+		return -EFAULT;
+	}
+	subdev = flink_get_register_subdevice(pdata, container.subdevice, container.offset, sizeof(u32));
+	if(IS_ERR(subdev)) {
+		return PTR_ERR(subdev);
+	}
+	container.old_value = flink_masked_write32(subdev, container.offset, container.mask, container.value);
+	if(copy_to_user((void __user *)arg, &container, sizeof(container)) != 0) {
+		return -EFAULT;
+	}
+	return 0;
+}
+
+/**
+ * flink_ioctl_field() - handles READ_FIELD and WRITE_FIELD
+ * @pdata: private data of the calling file
+ * @arg: user space pointer to a struct ioctl_field_container_t
+ * @write: true for WRITE_FIELD, READ_FIELD returns the field in value
+ */
+static long flink_ioctl_field(struct flink_private_data* pdata, unsigned long arg, bool write) {
+	struct ioctl_field_container_t container;
+	struct flink_subdevice* subdev;
+	u32 mask;
+	if(copy_from_user(&container, (void __user *)arg, sizeof(container)) != 0) {
+		return -EFAULT;
+	}
+	mask = flink_field_mask(container.shift, container.width);
+	subdev = flink_get_register_subdevice(pdata, container.subdevice, container.offset, sizeof(u32));
+	if(IS_ERR(subdev)) {
+		return PTR_ERR(subdev);
+	}
+	if(mask == 0) {
+		#if defined(DBG)
+			printk(KERN_DEBUG "  -> Illegal field: shift %u, width %u", container.shift, container.width);
+		#endif
+		return -EINVAL;
+	}
+	if(write) {
+		flink_masked_write32(subdev, container.offset, mask, container.value << container.shift);
+		return 0;
+	}
+	container.value = (flink_cache_read32(subdev, container.offset, false) & mask) >> container.shift;
+	#if defined(DBG)
+		printk(KERN_DEBUG "  -> Field value: 0x%x", container.value);
+	#endif
+	if(copy_to_user((void __user *)arg, &container, sizeof(container)) != 0) {
+		return -EFAULT;
+	}
+	return 0;
+}
+
+/**
+ * flink_ioctl_owned_bits() - handles CLAIM_BITS, RELEASE_BITS and WRITE_OWNED_BITS
+ * @pdata: private data of the calling file, owner of the bits
+ * @arg: user space pointer to a struct ioctl_mask_container_t
+ * @cmd: the ioctl command
+ */
+static long flink_ioctl_owned_bits(struct flink_private_data* pdata, unsigned long arg, unsigned int cmd) {
+	struct ioctl_mask_container_t container;
+	struct flink_subdevice* subdev;
+	int error;
+	if(copy_from_user(&container, (void __user *)arg, sizeof(container)) != 0) {
+		return -EFAULT;
+	}
+	subdev = flink_get_register_subdevice(pdata, container.subdevice, container.offset, sizeof(u32));
+	if(IS_ERR(subdev)) {
+		return PTR_ERR(subdev);
+	}
+	if(container.mask == 0) {
+		return -EINVAL;
+	}
+	switch(cmd) {
+		case CLAIM_BITS:
+			return flink_claim_bits(pdata, subdev, container.offset, container.mask);
+		case RELEASE_BITS:
+			return flink_release_bits(pdata, subdev, container.offset, container.mask);
+		default:
+			error = flink_write_owned_bits(pdata, subdev, container.offset, container.mask, container.value, &container.old_value);
+			if(error) {
+				return error;
+			}
+			if(copy_to_user((void __user *)arg, &container, sizeof(container)) != 0) {
+				return -EFAULT;
+			}
+			return 0;
+	}
+}
+
+/**
+ * flink_ioctl_cache() - handles SET_CACHEABLE and INVALIDATE_CACHE
+ * @pdata: private data of the calling file
+ * @arg: user space pointer to a struct ioctl_cache_container_t
+ * @cmd: the ioctl command
+ */
+static long flink_ioctl_cache(struct flink_private_data* pdata, unsigned long arg, unsigned int cmd) {
+	struct ioctl_cache_container_t container;
+	struct flink_subdevice* subdev;
+	if(copy_from_user(&container, (void __user *)arg, sizeof(container)) != 0) {
+		return -EFAULT;
+	}
+	subdev = flink_get_register_subdevice(pdata, container.subdevice, container.offset, container.size);
+	if(IS_ERR(subdev)) {
+		return PTR_ERR(subdev);
+	}
+	if(cmd == INVALIDATE_CACHE) {
+		flink_cache_invalidate(subdev, container.offset, container.size);
+		return 0;
+	}
+	return flink_cache_set_cacheable(subdev, container.offset, container.size, container.cacheable != 0);
+}
+
+/**
+ * flink_ioctl_program() - handles the micro-sequencer ioctls
+ * @pdata: private data of the calling file, which owns at most one program
+ * @arg: user space pointer to the container of the command
+ * @cmd: LOAD_PROGRAM, RUN_PROGRAM, TRIGGER_PROGRAM or READ_PROGRAM_RESULT
+ */
+static long flink_ioctl_program(struct flink_private_data* pdata, unsigned long arg, unsigned int cmd) {
+	struct ioctl_program_container_t program_container;
+	struct ioctl_trigger_container_t trigger_container;
+	struct ioctl_program_result_t result;
+	struct flink_program* prog;
+	int error = 0;
+	
+	switch(cmd) {
+		case LOAD_PROGRAM:
+			if(copy_from_user(&program_container, (void __user *)arg, sizeof(program_container)) != 0) {
+				return -EFAULT;
+			}
+			return flink_seq_load(pdata, &program_container);
+		case TRIGGER_PROGRAM:
+			if(copy_from_user(&trigger_container, (void __user *)arg, sizeof(trigger_container)) != 0) {
+				return -EFAULT;
+			}
+			break;
+	}
+	mutex_lock(&(pdata->program_lock));
+	prog = pdata->program;
+	if(prog == NULL) {
+		mutex_unlock(&(pdata->program_lock));
+		return -ENOENT;
+	}
+	if(cmd == TRIGGER_PROGRAM) {
+		error = flink_seq_attach(prog, &trigger_container);
+		mutex_unlock(&(pdata->program_lock));
+		return error;
+	}
+	mutex_lock(&(prog->lock));
+	if(cmd == RUN_PROGRAM) {
+		flink_seq_run(prog);
+	}
+	result.status = prog->status;
+	result.nof_runs = prog->nof_runs;
+	memcpy(result.results, prog->results, sizeof(result.results));
+	mutex_unlock(&(prog->lock));
+	mutex_unlock(&(pdata->program_lock));
+	if(copy_to_user((void __user *)arg, &result, sizeof(result)) != 0) {
+		return -EFAULT;
+	}
+	return 0;
+}
+
+/**
+ * flink_ioctl_timed_write() - handles TIMED_WRITE and TIMED_WRITE_RESULT
+ * @pdata: private data of the calling file
+ * @arg: user space pointer to a struct ioctl_timed_write_container_t or struct ioctl_timed_write_result_t
+ * @cmd: the ioctl command
+ */
+static long flink_ioctl_timed_write(struct flink_private_data* pdata, unsigned long arg, unsigned int cmd) {
+	struct ioctl_timed_write_container_t container;
+	struct ioctl_timed_write_result_t result;
+	int error;
+	if(cmd == TIMED_WRITE) {
+		if(copy_from_user(&container, (void __user *)arg, sizeof(container)) != 0) {
+			return -EFAULT;
 		}
+		error = flink_timed_write_submit(pdata, &container);
+		if(error) {
+			return error;
+		}
+		if(copy_to_user((void __user *)arg, &container, sizeof(container)) != 0) {
+			return -EFAULT;
+		}
+		return 0;
+	}
+	if(copy_from_user(&result, (void __user *)arg, sizeof(result)) != 0) {
+		return -EFAULT;
+	}
+	error = flink_timed_write_result(pdata, &result);
+	if(error) {
+		return error;
+	}
+	if(copy_to_user((void __user *)arg, &result, sizeof(result)) != 0) {
+		return -EFAULT;
+	}
+	return 0;
+}
+
+/**
+ * flink_ioctl_subscribe() - handles SUBSCRIBE_IRQ and UNSUBSCRIBE_IRQ
+ * @pdata: private data of the calling file
+ * @arg: user space pointer to the uint32_t IRQ number
+ * @cmd: the ioctl command
+ */
+static long flink_ioctl_subscribe(struct flink_private_data* pdata, unsigned long arg, unsigned int cmd) {
+	struct flink_irq_data* hwirq;
+	u32 irq_nr;
+	if(unlikely(pdata->fdev->nof_irqs == 0)) {
+		return -EPERM;
+	}
+	if(copy_from_user(&irq_nr, (void __user *)arg, sizeof(irq_nr)) != 0) {
+		return -EFAULT;
+	}
+	hwirq = flink_get_irq(pdata->fdev, irq_nr);
+	if(hwirq == NULL) {
+		return -EINVAL;
+	}
+	if(cmd == SUBSCRIBE_IRQ) {
+		return flink_subscribe_irq(pdata, hwirq);
+	}
+	return flink_unsubscribe_irq(pdata, hwirq);
+}
+
+/**
+ * flink_ioctl_irq_eventfd() - handles BIND_IRQ_EVENTFD and UNBIND_IRQ_EVENTFD
+ * @pdata: private data of the calling file, owner of the binding
+ * @arg: user space pointer to a struct ioctl_irq_eventfd_container_t
+ * @cmd: the ioctl command
+ */
+static long flink_ioctl_irq_eventfd(struct flink_private_data* pdata, unsigned long arg, unsigned int cmd) {
+	struct ioctl_irq_eventfd_container_t container;
+	struct flink_irq_data* hwirq;
+	if(unlikely(pdata->fdev->nof_irqs == 0)) {
+		return -EPERM;
+	}
+	if(copy_from_user(&container, (void __user *)arg, sizeof(container)) != 0) {
+		return -EFAULT;
+	}
+	hwirq = flink_get_irq(pdata->fdev, container.irq_nr);
+	if(hwirq == NULL) {
+		#if defined(DBG)
+			printk(KERN_DEBUG "  -> IRQ number %u is too high", container.irq_nr);
+		#endif
+		return -EINVAL;
+	}
+	if(cmd == BIND_IRQ_EVENTFD) {
+		return flink_bind_irq_eventfd(pdata, hwirq, container.fd);
+	}
+	return flink_unbind_irq_eventfd(pdata, hwirq);
+}
+
+/**
+ * flink_ioctl_irq_mode() - handles SET_IRQ_MODE
+ * @pdata: private data of the calling file
+ * @arg: user space pointer to a struct ioctl_irq_mode_container_t
+ *
+ * The mode is a property of the IRQ and applies to all files of the device.
+ * FLINK_IRQ_HARD fails with -EOPNOTSUPP if interrupt handlers are force-threaded.
+ */
+static long flink_ioctl_irq_mode(struct flink_private_data* pdata, unsigned long arg) {
+	struct ioctl_irq_mode_container_t container;
+	struct flink_irq_data* hwirq;
+	if(unlikely(pdata->fdev->nof_irqs == 0)) {
+		return -EPERM;
+	}
+	if(copy_from_user(&container, (void __user *)arg, sizeof(container)) != 0) {
+		return -EFAULT;
+	}
+	hwirq = flink_get_irq(pdata->fdev, container.irq_nr);
+	if(hwirq == NULL || container.mode > FLINK_IRQ_HARD) {
+		return -EINVAL;
+	}
+	if(container.mode == FLINK_IRQ_HARD && force_irqthreads()) {
+		#if defined(DBG)
+			printk(KERN_DEBUG "  -> IRQ handlers are force-threaded, no hard interrupt context");
+		#endif
+		return -EOPNOTSUPP;
 	}
+	WRITE_ONCE(hwirq->hard_irq, container.mode == FLINK_IRQ_HARD);
 	return 0;
 }
 
+/**
+ * flink_ioctl_atomic() - handles COMPARE_AND_SWAP and FETCH_AND_ADD
+ * @pdata: private data of the calling file
+ * @arg: user space pointer to a struct ioctl_atomic_container_t, old_value is returned in it
+ * @cmd: the ioctl command
+ */
+static long flink_ioctl_atomic(struct flink_private_data* pdata, unsigned long arg, unsigned int cmd) {
+	struct ioctl_atomic_container_t container;
+	struct flink_subdevice* subdev;
+	if(copy_from_user(&container, (void __user *)arg, sizeof(container)) != 0) {
+		return -EFAULT;
+	}
+	subdev = flink_get_register_subdevice(pdata, container.subdevice, container.offset, sizeof(u32));
+	if(IS_ERR(subdev)) {
+		return PTR_ERR(subdev);
+	}
+	if(cmd == COMPARE_AND_SWAP) {
+		container.old_value = flink_compare_and_swap32(subdev, container.offset, container.compare, container.value);
+	}
+	else {
+		container.old_value = flink_fetch_and_add32(subdev, container.offset, container.value);
+	}
+	#if defined(DBG)
+		printk(KERN_DEBUG "  -> Old value: 0x%x", container.old_value);
+	#endif
+	if(copy_to_user((void __user *)arg, &container, sizeof(container)) != 0) {
+		return -EFAULT;
+	}
+	return 0;
+}
+
+/**
+ * flink_ioctl_poll() - handles POLL_REGISTER
+ * @pdata: private data of the calling file
+ * @arg: user space pointer to a struct ioctl_poll_container_t, last_value and elapsed_ns are returned in it
+ */
+static long flink_ioctl_poll(struct flink_private_data* pdata, unsigned long arg) {
+	struct ioctl_poll_container_t container;
+	struct flink_subdevice* subdev;
+	int ret;
+	if(copy_from_user(&container, (void __user *)arg, sizeof(container)) != 0) {
+		return -EFAULT;
+	}
+	if(container.mode != FLINK_POLL_BUSY && container.mode != FLINK_POLL_SLEEP) {
+		return -EINVAL;
+	}
+	if(container.mode == FLINK_POLL_BUSY && container.timeout_us > FLINK_POLL_MAX_BUSY_US) {
+		return -EINVAL;
+	}
+	subdev = flink_get_register_subdevice(pdata, container.subdevice, container.offset, sizeof(u32));
+	if(IS_ERR(subdev)) {
+		return PTR_ERR(subdev);
+	}
+	ret = flink_poll_register(pdata->fdev, subdev->base_addr + container.offset, &container);
+	#if defined(DBG)
+		printk(KERN_DEBUG "  -> Poll result %d, last value: 0x%x, elapsed: %llu ns", ret, container.last_value, container.elapsed_ns);
+	#endif
+	if(copy_to_user((void __user *)arg, &container, sizeof(container)) != 0) {
+		return -EFAULT;
+	}
+	return ret;
+}
+
 long flink_ioctl(struct file* f, unsigned int cmd, unsigned long arg) {
 	int error = 0;
 	struct flink_private_data* pdata = (struct flink_private_data*)(f->private_data);
@@ -238,6 +2940,11 @@ long flink_ioctl(struct file* f, unsigned int cmd, unsigned long arg) {
 	u8 id;
 	struct ioctl_bit_container_t rwbit_container;
 	struct ioctl_container_t rw_container;
+	struct ioctl_batch_container_t batch_container;
+	struct ioctl_batch_entry_t* batch;
+	struct ioctl_table_container_t table_container;
+	struct ioctl_find_container_t find_container;
+	u8* table;
 	unsigned long rsize = 0;
 	unsigned long wsize = 0;
 	u32 temp;
@@ -252,6 +2959,10 @@ long flink_ioctl(struct file* f, unsigned int cmd, unsigned long arg) {
 	#if defined(DBG)
 		printk(KERN_DEBUG "[%s] I/O control call...", MODULE_NAME);
 	#endif
+	// Accesses of a write-behind file are executed after its queued writes
+	if(pdata->write_behind && cmd != FLUSH && cmd != SET_WRITE_BEHIND) {
+		flink_write_queue_wait(pdata->fdev);
+	}
 	switch(cmd) {
 		case SELECT_SUBDEVICE:
 			#if defined(DBG)
@@ -321,6 +3032,85 @@ long flink_ioctl(struct file* f, unsigned int cmd, unsigned long arg) {
 				return -EINVAL;
 			}
 			break;
+		case READ_SUBDEVICE_TABLE:
+			#if defined(DBG)
+				printk(KERN_DEBUG "  -> READ_SUBDEVICE_TABLE (0x%x)", READ_SUBDEVICE_TABLE);
+			#endif
+			error = copy_from_user(&table_container, (void __user *)arg, sizeof(table_container));
+			if(error != 0) {
+				#if defined(DBG)
+					printk(KERN_DEBUG "  -> Error while copying from userspace: %i", error);
+				#endif
+				return -EINVAL;
+			}
+			table_container.nof_entries = min_t(u32, table_container.nof_entries, pdata->fdev->nof_subdevices);
+			if(table_container.nof_entries > 0) {
+				table = kmalloc_array(table_container.nof_entries, FLINKLIB_SUBDEVICE_SIZE, GFP_KERNEL);
+				if(table == NULL) {
+					return -ENOMEM;
+				}
+				for(id = 0; id < table_container.nof_entries; id++) {
+					src = pdata->fdev->subdevice_table[id];
+					if(src != NULL) {
+						memcpy(table + id * FLINKLIB_SUBDEVICE_SIZE, &(src->id), FLINKLIB_SUBDEVICE_SIZE);
+					}
+					else {
+						memset(table + id * FLINKLIB_SUBDEVICE_SIZE, 0, FLINKLIB_SUBDEVICE_SIZE);
+					}
+				}
+				rsize = copy_to_user((void __user *)table_container.data, table, table_container.nof_entries * FLINKLIB_SUBDEVICE_SIZE);
+				kfree(table);
+				if(rsize > 0) {
+					#if defined(DBG)
+						printk(KERN_DEBUG "  -> Copying to user space failed: %lu bytes not copied!", rsize);
+					#endif
+					return -EFAULT;
+				}
+			}
+			error = copy_to_user((void __user *)arg, &table_container, sizeof(table_container));
+			if(error != 0) {
+				#if defined(DBG)
+					printk(KERN_DEBUG "  -> Error while copying to userspace: %i", error);
+				#endif
+				return -EINVAL;
+			}
+			return table_container.nof_entries;
+		case FIND_SUBDEVICE:
+			#if defined(DBG)
+				printk(KERN_DEBUG "  -> FIND_SUBDEVICE (0x%x)", FIND_SUBDEVICE);
+			#endif
+			error = copy_from_user(&find_container, (void __user *)arg, sizeof(find_container));
+			if(error != 0) {
+				#if defined(DBG)
+					printk(KERN_DEBUG "  -> Error while copying from userspace: %i", error);
+				#endif
+				return -EINVAL;
+			}
+			switch(find_container.key_type) {
+				case FLINK_FIND_BY_FUNCTION:
+					src = flink_get_subdevice_by_function(pdata->fdev, (u16)find_container.key);
+					break;
+				case FLINK_FIND_BY_UNIQUE_ID:
+					src = flink_get_subdevice_by_unique_id(pdata->fdev, find_container.key);
+					break;
+				default:
+					return -EINVAL;
+			}
+			if(src == NULL) {
+				#if defined(DBG)
+					printk(KERN_DEBUG "  -> No subdevice with key 0x%x found", find_container.key);
+				#endif
+				return -ENOENT;
+			}
+			find_container.subdevice = src->id;
+			error = copy_to_user((void __user *)arg, &find_container, sizeof(find_container));
+			if(error != 0) {
+				#if defined(DBG)
+					printk(KERN_DEBUG "  -> Error while copying to userspace: %i", error);
+				#endif
+				return -EINVAL;
+			}
+			break;
 		case READ_SINGLE_BIT:
 			#if defined(DBG)
 				printk(KERN_DEBUG "  -> READ_SINGLE_BIT (0x%x)", READ_SINGLE_BIT);
@@ -332,11 +3122,17 @@ long flink_ioctl(struct file* f, unsigned int cmd, unsigned long arg) {
 				#endif
 				return -EINVAL;
 			}
-			temp = pdata->fdev->bus_ops->read32(pdata->fdev, pdata->current_subdevice->base_addr + rwbit_container.offset);
+			if(rwbit_container.bit >= 32) {
+				return -EINVAL;
+			}
+			if(!flink_subdevice_accessible(pdata->current_subdevice, pdata)) {
+				return -EBUSY;
+			}
+			temp = flink_cache_read32(pdata->current_subdevice, rwbit_container.offset, false);
 			#if defined(DBG)
 				printk(KERN_DEBUG "  -> Read from device: 0x%x", temp);
 			#endif
-			rwbit_container.value = ((temp & (1 << rwbit_container.bit)) != 0);
+			rwbit_container.value = ((temp & BIT(rwbit_container.bit)) != 0);
 			#if defined(DBG)
 				printk(KERN_DEBUG "  -> Bit value: 0x%x", rwbit_container.value);
 			#endif
@@ -364,23 +3160,14 @@ long flink_ioctl(struct file* f, unsigned int cmd, unsigned long arg) {
 					printk(KERN_DEBUG "  -> Copied from user space: offset = 0x%x, bit = %u, value = %u", rwbit_container.offset, rwbit_container.bit, rwbit_container.value);
 				#endif
 			}
-			temp = pdata->fdev->bus_ops->read32(pdata->fdev, pdata->current_subdevice->base_addr + rwbit_container.offset);
-			#if defined(DBG)
-				printk(KERN_DEBUG "  -> Read from device: 0x%x", temp);
-			#endif
-			if(rwbit_container.value != 0) { // set bit
-				temp |= (1 << rwbit_container.bit);
-				#if defined(DBG)
-					printk(KERN_DEBUG "  -> Setting bit by writing 0x%x to device", temp);
-				#endif
+			if(rwbit_container.bit >= 32) {
+				return -EINVAL;
 			}
-			else { // clear bit
-				temp &= ~(1 << rwbit_container.bit);
-				#if defined(DBG)
-					printk(KERN_DEBUG "  -> Clearing bit by writing 0x%x to device", temp);
-				#endif
+			if(!flink_subdevice_accessible(pdata->current_subdevice, pdata)) {
+				return -EBUSY;
 			}
-			pdata->fdev->bus_ops->write32(pdata->fdev, pdata->current_subdevice->base_addr + rwbit_container.offset, temp);
+			// set or clear bit
+			flink_masked_write32(pdata->current_subdevice, rwbit_container.offset, BIT(rwbit_container.bit), (rwbit_container.value != 0) ? 0xFFFFFFFF : 0);
 			break;
 		case SELECT_AND_READ_BIT:
 			#if defined(DBG)
@@ -393,6 +3180,12 @@ long flink_ioctl(struct file* f, unsigned int cmd, unsigned long arg) {
 				#endif
 				return -EINVAL;
 			}
+			if(rwbit_container.bit >= 32) {
+				return -EINVAL;
+			}
+			if(flink_subdevice_bound_elsewhere(pdata, rwbit_container.subdevice)) {
+				return -EPERM;
+			}
 			src = flink_get_subdevice_by_id(pdata->fdev, rwbit_container.subdevice);
 			if(src == NULL) {
 				#if defined(DBG)
@@ -400,11 +3193,14 @@ long flink_ioctl(struct file* f, unsigned int cmd, unsigned long arg) {
 				#endif
 				return -EINVAL;
 			}
-			temp = pdata->fdev->bus_ops->read32(pdata->fdev, src->base_addr + rwbit_container.offset);
+			if(!flink_subdevice_accessible(src, pdata)) {
+				return -EBUSY;
+			}
+			temp = flink_cache_read32(src, rwbit_container.offset, false);
 			#if defined(DBG)
 				printk(KERN_DEBUG "  -> Read from device: 0x%x", temp);
 			#endif
-			rwbit_container.value = ((temp & (1 << rwbit_container.bit)) != 0);
+			rwbit_container.value = ((temp & BIT(rwbit_container.bit)) != 0);
 			#if defined(DBG)
 				printk(KERN_DEBUG "  -> Bit value: 0x%x", rwbit_container.value);
 			#endif
@@ -432,6 +3228,12 @@ long flink_ioctl(struct file* f, unsigned int cmd, unsigned long arg) {
 					printk(KERN_DEBUG "  -> Copied from user space: offset = 0x%x, bit = %u, value = %u", rwbit_container.offset, rwbit_container.bit, rwbit_container.value);
 				#endif
 			}
+			if(rwbit_container.bit >= 32) {
+				return -EINVAL;
+			}
+			if(flink_subdevice_bound_elsewhere(pdata, rwbit_container.subdevice)) {
+				return -EPERM;
+			}
 			src = flink_get_subdevice_by_id(pdata->fdev, rwbit_container.subdevice);
 			if(src == NULL) {
 				#if defined(DBG)
@@ -439,23 +3241,11 @@ long flink_ioctl(struct file* f, unsigned int cmd, unsigned long arg) {
 				#endif
 				return -EINVAL;
 			}
-			temp = pdata->fdev->bus_ops->read32(pdata->fdev, src->base_addr + rwbit_container.offset);
-			#if defined(DBG)
-				printk(KERN_DEBUG "  -> Read from device: 0x%x", temp);
-			#endif
-			if(rwbit_container.value != 0) { // set bit
-				temp |= (1 << rwbit_container.bit);
-				#if defined(DBG)
-					printk(KERN_DEBUG "  -> Setting bit by writing 0x%x to device", temp);
-				#endif
-			}
-			else { // clear bit
-				temp &= ~(1 << rwbit_container.bit);
-				#if defined(DBG)
-					printk(KERN_DEBUG "  -> Clearing bit by writing 0x%x to device", temp);
-				#endif
+			if(!flink_subdevice_accessible(src, pdata)) {
+				return -EBUSY;
 			}
-			pdata->fdev->bus_ops->write32(pdata->fdev, src->base_addr + rwbit_container.offset, temp);
+			// set or clear bit
+			flink_masked_write32(src, rwbit_container.offset, BIT(rwbit_container.bit), (rwbit_container.value != 0) ? 0xFFFFFFFF : 0);
 			break;
 		case SELECT_AND_READ:
 			#if defined(DBG)
@@ -474,6 +3264,9 @@ long flink_ioctl(struct file* f, unsigned int cmd, unsigned long arg) {
 				#endif
 				return -EINVAL;
 			}
+			if(flink_subdevice_bound_elsewhere(pdata, rw_container.subdevice)) {
+				return -EPERM;
+			}
 			src = flink_get_subdevice_by_id(pdata->fdev, rw_container.subdevice);
 			if(src == NULL) {
 				#if defined(DBG)
@@ -481,16 +3274,25 @@ long flink_ioctl(struct file* f, unsigned int cmd, unsigned long arg) {
 				#endif
 				return -EINVAL;
 			}
+			if(!flink_subdevice_accessible(src, pdata)) {
+				return -EBUSY;
+			}
 			if (rw_container.offset > src->mem_size) {
 				#if defined(DBG)
 					printk(KERN_DEBUG "  -> offset > mem_size");
 				#endif
 				return -EINVAL;
 			}
+			if((rw_container.size == 1 || rw_container.size == 2 || rw_container.size == 4) && !flink_bus_width_supported(pdata->fdev, rw_container.size)) {
+				#if defined(DBG)
+					printk(KERN_DEBUG "  -> Access size not supported by the bus: %u bytes", rw_container.size);
+				#endif
+				return -EOPNOTSUPP;
+			}
 			switch(rw_container.size) {
 				case 1: {
 					u8 rdata = 0;
-					rdata = pdata->fdev->bus_ops->read8(pdata->fdev, src->base_addr + rw_container.offset);
+					rdata = flink_bus_read8(pdata->fdev, src->base_addr + rw_container.offset);
 					rsize = copy_to_user((void __user *)rw_container.data, &rdata, sizeof(rdata));
 					if(rsize > 0) {
 						#if defined(DBG)
@@ -505,7 +3307,7 @@ long flink_ioctl(struct file* f, unsigned int cmd, unsigned long arg) {
 				}
 				case 2: {
 					u16 rdata = 0;
-					rdata = pdata->fdev->bus_ops->read16(pdata->fdev, src->base_addr + rw_container.offset);
+					rdata = flink_bus_read16(pdata->fdev, src->base_addr + rw_container.offset);
 					rsize = copy_to_user((void __user *)rw_container.data, &rdata, sizeof(rdata));
 					if(rsize > 0) {
 						#if defined(DBG)
@@ -520,7 +3322,7 @@ long flink_ioctl(struct file* f, unsigned int cmd, unsigned long arg) {
 				}
 				case 4: {
 					u32 rdata = 0;
-					rdata = pdata->fdev->bus_ops->read32(pdata->fdev, src->base_addr + rw_container.offset);
+					rdata = flink_cache_read32(src, rw_container.offset, false);
 					rsize = copy_to_user((void __user *)rw_container.data, &rdata, sizeof(rdata));
 					if(rsize > 0) {
 						#if defined(DBG)
@@ -554,6 +3356,9 @@ long flink_ioctl(struct file* f, unsigned int cmd, unsigned long arg) {
 				#endif
 				return -EINVAL;
 			}
+			if(flink_subdevice_bound_elsewhere(pdata, rw_container.subdevice)) {
+				return -EPERM;
+			}
 			src = flink_get_subdevice_by_id(pdata->fdev, rw_container.subdevice);
 			if(src == NULL) {
 				#if defined(DBG)
@@ -561,15 +3366,25 @@ long flink_ioctl(struct file* f, unsigned int cmd, unsigned long arg) {
 				#endif
 				return -EINVAL;
 			}
+			if(!flink_subdevice_accessible(src, pdata)) {
+				return -EBUSY;
+			}
 			if (rw_container.offset > src->mem_size) {
 				#if defined(DBG)
 					printk(KERN_DEBUG "  -> offset > mem_size");
 				#endif
 				return -EINVAL;
 			}
+			if((rw_container.size == 1 || rw_container.size == 2 || rw_container.size == 4) && !flink_bus_width_supported(pdata->fdev, rw_container.size)) {
+				#if defined(DBG)
+					printk(KERN_DEBUG "  -> Access size not supported by the bus: %u bytes", rw_container.size);
+				#endif
+				return -EOPNOTSUPP;
+			}
 			switch(rw_container.size) {
 				case 1: {
 					u8 wdata = 0;
+					u32 generation;
 					wsize = copy_from_user(&wdata, (void __user *)rw_container.data, sizeof(wdata));
 					if(wsize > 0) {
 						#if defined(DBG)
@@ -577,7 +3392,9 @@ long flink_ioctl(struct file* f, unsigned int cmd, unsigned long arg) {
 						#endif
 						return -EINVAL;
 					}
-					pdata->fdev->bus_ops->write8(pdata->fdev, src->base_addr + rw_container.offset, wdata);
+					generation = flink_cache_generation(src);
+					flink_bus_write8(pdata->fdev, src->base_addr + rw_container.offset, wdata);
+					flink_register_written(src, rw_container.offset, sizeof(wdata), wdata, generation);
 					#if defined(DBG)
 						printk(KERN_DEBUG "  -> Value:  0x%x", wdata);
 					#endif
@@ -585,6 +3402,7 @@ long flink_ioctl(struct file* f, unsigned int cmd, unsigned long arg) {
 				}
 				case 2: {
 					u16 wdata = 0;
+					u32 generation;
 					wsize = copy_from_user(&wdata, (void __user *)rw_container.data, sizeof(wdata));
 					if(wsize > 0) {
 						#if defined(DBG)
@@ -592,7 +3410,9 @@ long flink_ioctl(struct file* f, unsigned int cmd, unsigned long arg) {
 						#endif
 						return -EINVAL;
 					}
-					pdata->fdev->bus_ops->write16(pdata->fdev, src->base_addr + rw_container.offset, wdata);
+					generation = flink_cache_generation(src);
+					flink_bus_write16(pdata->fdev, src->base_addr + rw_container.offset, wdata);
+					flink_register_written(src, rw_container.offset, sizeof(wdata), wdata, generation);
 					#if defined(DBG)
 						printk(KERN_DEBUG "  -> Value:  0x%x", wdata);
 					#endif
@@ -600,6 +3420,7 @@ long flink_ioctl(struct file* f, unsigned int cmd, unsigned long arg) {
 				}
 				case 4: {
 					u32 wdata = 0;
+					u32 generation;
 					wsize = copy_from_user(&wdata, (void __user *)rw_container.data, sizeof(wdata));
 					if(wsize > 0) {
 						#if defined(DBG)
@@ -607,7 +3428,9 @@ long flink_ioctl(struct file* f, unsigned int cmd, unsigned long arg) {
 						#endif
 						return -EINVAL;
 					}
-					pdata->fdev->bus_ops->write32(pdata->fdev, src->base_addr + rw_container.offset, wdata);
+					generation = flink_cache_generation(src);
+					flink_bus_write32(pdata->fdev, src->base_addr + rw_container.offset, wdata);
+					flink_register_written(src, rw_container.offset, sizeof(wdata), wdata, generation);
 					#if defined(DBG)
 						printk(KERN_DEBUG "  -> Value:  0x%x", wdata);
 					#endif
@@ -617,6 +3440,139 @@ long flink_ioctl(struct file* f, unsigned int cmd, unsigned long arg) {
 					return -EINVAL;
 			}
 			break;
+		case READ_WRITE_BATCH:
+			#if defined(DBG)
+				printk(KERN_DEBUG "  -> READ_WRITE_BATCH (0x%x)", READ_WRITE_BATCH);
+			#endif
+			error = copy_from_user(&batch_container, (void __user *)arg, sizeof(batch_container));
+			if(error != 0) {
+				#if defined(DBG)
+					printk(KERN_DEBUG "  -> Error while copying from userspace: %i", error);
+				#endif
+				return -EINVAL;
+			}
+			if(batch_container.nof_entries == 0 || batch_container.nof_entries > MAX_BATCH_ENTRIES) {
+				#if defined(DBG)
+					printk(KERN_DEBUG "  -> Illegal number of batch entries: %u", batch_container.nof_entries);
+				#endif
+				return -EINVAL;
+			}
+			batch = memdup_user((void __user *)batch_container.entries, batch_container.nof_entries * sizeof(*batch));
+			if(IS_ERR(batch)) {
+				return PTR_ERR(batch);
+			}
+			error = flink_execute_batch(pdata, batch, batch_container.nof_entries);
+			if(error > 0) {
+				rsize = copy_to_user((void __user *)batch_container.entries, batch, batch_container.nof_entries * sizeof(*batch));
+				if(rsize > 0) {
+					#if defined(DBG)
+						printk(KERN_DEBUG "  -> Copying to user space failed: %lu bytes not copied!", rsize);
+					#endif
+					error = -EFAULT;
+				}
+			}
+			kfree(batch);
+			return error;
+		case MASKED_WRITE:
+			#if defined(DBG)
+				printk(KERN_DEBUG "  -> MASKED_WRITE (0x%x)", MASKED_WRITE);
+			#endif
+			return flink_ioctl_masked_write(pdata, arg);
+		case READ_FIELD:
+			#if defined(DBG)
+				printk(KERN_DEBUG "  -> READ_FIELD (0x%x)", READ_FIELD);
+			#endif
+			return flink_ioctl_field(pdata, arg, false);
+		case WRITE_FIELD:
+			#if defined(DBG)
+				printk(KERN_DEBUG "  -> WRITE_FIELD (0x%x)", WRITE_FIELD);
+			#endif
+			return flink_ioctl_field(pdata, arg, true);
+		case COMPARE_AND_SWAP:
+		case FETCH_AND_ADD:
+			#if defined(DBG)
+				printk(KERN_DEBUG "  -> %s (0x%x)", (cmd == COMPARE_AND_SWAP) ? "COMPARE_AND_SWAP" : "FETCH_AND_ADD", cmd);
+			#endif
+			return flink_ioctl_atomic(pdata, arg, cmd);
+		case SET_RELAXED:
+			if(get_user(temp, (u32 __user *)arg)) {
+				return -EFAULT;
+			}
+			#if defined(DBG)
+				printk(KERN_DEBUG "  -> SET_RELAXED (0x%x): %u", SET_RELAXED, temp);
+			#endif
+			if(temp != 0 && !flink_bus_relaxed_supported(pdata->fdev)) {
+				return -EOPNOTSUPP;
+			}
+			pdata->relaxed = (temp != 0);
+			return 0;
+		case FLUSH:
+			#if defined(DBG)
+				printk(KERN_DEBUG "  -> FLUSH (0x%x)", FLUSH);
+			#endif
+			return flink_sync(pdata);
+		case SET_WRITE_BEHIND:
+			if(get_user(temp, (u32 __user *)arg)) {
+				return -EFAULT;
+			}
+			#if defined(DBG)
+				printk(KERN_DEBUG "  -> SET_WRITE_BEHIND (0x%x): %u", SET_WRITE_BEHIND, temp);
+			#endif
+			if(temp == 0 && pdata->write_behind) {
+				pdata->write_behind = false;
+				return flink_write_queue_sync(pdata);
+			}
+			pdata->write_behind = (temp != 0);
+			return 0;
+		case CLAIM_BITS:
+		case RELEASE_BITS:
+		case WRITE_OWNED_BITS:
+			#if defined(DBG)
+				printk(KERN_DEBUG "  -> %s (0x%x)", (cmd == CLAIM_BITS) ? "CLAIM_BITS" : (cmd == RELEASE_BITS) ? "RELEASE_BITS" : "WRITE_OWNED_BITS", cmd);
+			#endif
+			return flink_ioctl_owned_bits(pdata, arg, cmd);
+		case SET_CACHEABLE:
+		case INVALIDATE_CACHE:
+			#if defined(DBG)
+				printk(KERN_DEBUG "  -> %s (0x%x)", (cmd == SET_CACHEABLE) ? "SET_CACHEABLE" : "INVALIDATE_CACHE", cmd);
+			#endif
+			return flink_ioctl_cache(pdata, arg, cmd);
+		case LOAD_PROGRAM:
+		case RUN_PROGRAM:
+		case TRIGGER_PROGRAM:
+		case READ_PROGRAM_RESULT:
+			#if defined(DBG)
+				printk(KERN_DEBUG "  -> %s (0x%x)", (cmd == LOAD_PROGRAM) ? "LOAD_PROGRAM" : (cmd == RUN_PROGRAM) ? "RUN_PROGRAM" : (cmd == TRIGGER_PROGRAM) ? "TRIGGER_PROGRAM" : "READ_PROGRAM_RESULT", cmd);
+			#endif
+			return flink_ioctl_program(pdata, arg, cmd);
+		case TIMED_WRITE:
+		case TIMED_WRITE_RESULT:
+			#if defined(DBG)
+				printk(KERN_DEBUG "  -> %s (0x%x)", (cmd == TIMED_WRITE) ? "TIMED_WRITE" : "TIMED_WRITE_RESULT", cmd);
+			#endif
+			return flink_ioctl_timed_write(pdata, arg, cmd);
+		case BIND_IRQ_EVENTFD:
+		case UNBIND_IRQ_EVENTFD:
+			#if defined(DBG)
+				printk(KERN_DEBUG "  -> %s (0x%x)", (cmd == BIND_IRQ_EVENTFD) ? "BIND_IRQ_EVENTFD" : "UNBIND_IRQ_EVENTFD", cmd);
+			#endif
+			return flink_ioctl_irq_eventfd(pdata, arg, cmd);
+		case SUBSCRIBE_IRQ:
+		case UNSUBSCRIBE_IRQ:
+			#if defined(DBG)
+				printk(KERN_DEBUG "  -> %s (0x%x)", (cmd == SUBSCRIBE_IRQ) ? "SUBSCRIBE_IRQ" : "UNSUBSCRIBE_IRQ", cmd);
+			#endif
+			return flink_ioctl_subscribe(pdata, arg, cmd);
+		case SET_IRQ_MODE:
+			#if defined(DBG)
+				printk(KERN_DEBUG "  -> SET_IRQ_MODE (0x%x)", cmd);
+			#endif
+			return flink_ioctl_irq_mode(pdata, arg);
+		case POLL_REGISTER:
+			#if defined(DBG)
+				printk(KERN_DEBUG "  -> POLL_REGISTER (0x%x)", cmd);
+			#endif
+			return flink_ioctl_poll(pdata, arg);
 		case REGISTER_IRQ: 
 			#if defined(DBG)
 				printk(KERN_DEBUG "[%s] Register IRQ (0x%x)", MODULE_NAME, REGISTER_IRQ);
@@ -643,40 +3599,32 @@ long flink_ioctl(struct file* f, unsigned int cmd, unsigned long arg) {
 				printk(KERN_WARNING "[%s] IRQ number %lu is too high. Number must be between 0 and %lu", MODULE_NAME, (long unsigned int)requested_irq_nr, (long unsigned int)pdata->fdev->nof_irqs-1);
 				return -EINVAL;
 			}
-			// generate IRQ structure and link to the correct entry in the list, which is sorted by PID
-			list_for_each_entry(hwirq, &(pdata->fdev->hw_irq_data), list) {
-    			if (hwirq->irq_nr == requested_irq_nr) {
-					mutex_lock(&(hwirq->lock_for_ioctl)); // It's not allowed for two processes to read and write the list at the same time.
-        			list_for_each_entry(fsignal, &(hwirq->flink_process_data), list) {
-						if(unlikely(fsignal->user_task->pid == user_task->pid)) {
-							printk(KERN_WARNING "[%s] IRQ %lu is already registered oh the pid", MODULE_NAME, (long unsigned int)hwirq->irq_nr);
-							mutex_unlock(&(hwirq->lock_for_ioctl));
-							return -EINVAL;
-						}
-					}
-					fsignal = kzalloc(sizeof(struct flink_process_data), GFP_KERNEL);
-					if(unlikely(!fsignal)) {
-						printk(KERN_ERR "[%s] Failed to allocate memory for signal witch depends on irq %lu", MODULE_NAME, (long unsigned int)hwirq->irq_nr);
-						mutex_unlock(&(hwirq->lock_for_ioctl));
-						return -ENOMEM;
-					}
-					INIT_LIST_HEAD(&(fsignal->list));
-					fsignal->user_task = user_task;
-					hwirq->signal_nr_with_offset = pdata->fdev->signal_offset + hwirq->irq_nr;
-					
-					spin_lock_bh(&(hwirq->irq_lock));
-					list_add(&(fsignal->list), &(hwirq->flink_process_data)); // This is very critical when an IRQ is fired (IRQ reads this list and here it has been modified).
-					spin_unlock_bh(&(hwirq->irq_lock));
+			// generate the signal structure and link it to the entry of the IRQ
+			hwirq = flink_get_irq(pdata->fdev, requested_irq_nr);
+			mutex_lock(&(hwirq->lock_for_ioctl)); // It's not allowed for two processes to read and write the list at the same time.
+			list_for_each_entry(fsignal, &(hwirq->flink_process_data), list) {
+				if(unlikely(fsignal->user_task->pid == user_task->pid)) {
+					printk(KERN_WARNING "[%s] IRQ %lu is already registered oh the pid", MODULE_NAME, (long unsigned int)hwirq->irq_nr);
 					mutex_unlock(&(hwirq->lock_for_ioctl));
-
-					hwirq->signal_count++;
-					#if defined(DBG)
-						printk(KERN_DEBUG "  -> Signal %lu for process %lu registerd", hwirq->signal_nr_with_offset, user_task->pid);
-					#endif
-        			return hwirq->signal_nr_with_offset;
+					return -EINVAL;
 				}
 			}
-			break;
+			fsignal = kzalloc(sizeof(struct flink_process_data), GFP_KERNEL);
+			if(unlikely(!fsignal)) {
+				printk(KERN_ERR "[%s] Failed to allocate memory for signal witch depends on irq %lu", MODULE_NAME, (long unsigned int)hwirq->irq_nr);
+				mutex_unlock(&(hwirq->lock_for_ioctl));
+				return -ENOMEM;
+			}
+			INIT_LIST_HEAD(&(fsignal->list));
+			fsignal->user_task = user_task;
+			hwirq->signal_nr_with_offset = pdata->fdev->signal_offset + hwirq->irq_nr;
+			list_add_rcu(&(fsignal->list), &(hwirq->flink_process_data)); // The IRQ handler walks this list under RCU only.
+			hwirq->signal_count++;
+			mutex_unlock(&(hwirq->lock_for_ioctl));
+			#if defined(DBG)
+				printk(KERN_DEBUG "  -> Signal %lu for process %lu registerd", hwirq->signal_nr_with_offset, user_task->pid);
+			#endif
+			return hwirq->signal_nr_with_offset;
 		case UNREGISTER_IRQ:
 			#if defined(DBG)
 				printk(KERN_DEBUG "[%s] Unregister IRQ (0x%x)", MODULE_NAME, UNREGISTER_IRQ);
@@ -703,45 +3651,36 @@ long flink_ioctl(struct file* f, unsigned int cmd, unsigned long arg) {
 				printk(KERN_WARNING "[%s] IRQ number %lu is too high. Number must be between 0 and %lu", MODULE_NAME, (long unsigned int)requested_irq_nr, (long unsigned int)pdata->fdev->nof_irqs-1);
 				return -EINVAL;
 			}
-			list_for_each_entry(hwirq, &(pdata->fdev->hw_irq_data), list) {
-    			if(hwirq->irq_nr == requested_irq_nr) {
-					if(unlikely(hwirq->signal_count == 0)){
-						printk(KERN_WARNING "[%s] No signal registered on the requested IRQ: %lu", MODULE_NAME, (long unsigned int)hwirq->irq_nr);
-						return -EINVAL;
-					}
-					mutex_lock(&(hwirq->lock_for_ioctl)); // It's not allowed for two processes to read and write the list at the same time.
-					found_entry = false;
-        			list_for_each_entry(fsignal, &(hwirq->flink_process_data), list) {
-						if(fsignal->user_task->pid == user_task->pid) {
-							#if defined(DBG)
-								printk(KERN_DEBUG "  -> Found list entry to remove");
-							#endif
-							found_entry = true;
-							break;
-						}
-					}
-					if(likely(found_entry)) {
-						spin_lock_bh(&(hwirq->irq_lock));
-						list_del(&(fsignal->list)); // This is very critical when an IRQ is fired (IRQ reads this list and here it has been modified).
-						spin_unlock_bh(&(hwirq->irq_lock));
-						mutex_unlock(&(hwirq->lock_for_ioctl));
-
-						if(fsignal) {
-							kfree(fsignal);
-						}
-						#if defined(DBG)
-							printk(KERN_DEBUG "  -> Signal %lu for process %lu unregisterd", hwirq->signal_nr_with_offset, user_task->pid);
-						#endif
-					} else {
-						mutex_unlock(&(hwirq->lock_for_ioctl));
-						#if defined(DBG)
-							printk(KERN_DEBUG "  -> No list entry found to remove");
-						#endif
-						return -EINVAL;
-					}
-        			break;
+			hwirq = flink_get_irq(pdata->fdev, requested_irq_nr);
+			if(unlikely(hwirq->signal_count == 0)){
+				printk(KERN_WARNING "[%s] No signal registered on the requested IRQ: %lu", MODULE_NAME, (long unsigned int)hwirq->irq_nr);
+				return -EINVAL;
+			}
+			mutex_lock(&(hwirq->lock_for_ioctl)); // It's not allowed for two processes to read and write the list at the same time.
+			found_entry = false;
+			list_for_each_entry(fsignal, &(hwirq->flink_process_data), list) {
+				if(fsignal->user_task->pid == user_task->pid) {
+					#if defined(DBG)
+						printk(KERN_DEBUG "  -> Found list entry to remove");
+					#endif
+					found_entry = true;
+					break;
 				}
 			}
+			if(likely(found_entry)) {
+				list_del_rcu(&(fsignal->list)); // The IRQ handler may still walk over the entry until the grace period ends.
+				mutex_unlock(&(hwirq->lock_for_ioctl));
+				kfree_rcu(fsignal, rcu);
+				#if defined(DBG)
+					printk(KERN_DEBUG "  -> Signal %lu for process %lu unregisterd", hwirq->signal_nr_with_offset, user_task->pid);
+				#endif
+			} else {
+				mutex_unlock(&(hwirq->lock_for_ioctl));
+				#if defined(DBG)
+					printk(KERN_DEBUG "  -> No list entry found to remove");
+				#endif
+				return -EINVAL;
+			}
 			break;
 		case GET_SIGNAL_OFFSET:
 			#if defined(DBG)
@@ -778,6 +3717,132 @@ long flink_ioctl(struct file* f, unsigned int cmd, unsigned long arg) {
 	return 0;
 }
 
+/**
+ * flink_mmap() - maps the registers of the selected subdevice into user space
+ * @f: the file
+ * @vma: the user memory area
+ *
+ * Only available for memory mapped buses, which provide a physical address
+ * through their bus operations. The mapping is uncached and starts at the page
+ * containing the subdevice, i.e. the first register of the subdevice lies at
+ * offset (base_addr % PAGE_SIZE) within the mapping.
+ */
+static void flink_vm_open(struct vm_area_struct* vma) {
+	struct flink_subdevice* subdev = vma->vm_private_data;
+	atomic_inc(&(subdev->nof_mappings));
+}
+
+static void flink_vm_close(struct vm_area_struct* vma) {
+	struct flink_subdevice* subdev = vma->vm_private_data;
+	atomic_dec(&(subdev->nof_mappings));
+}
+
+// counts the mappings of a subdevice, the mapping keeps the file and so the subdevice alive
+static const struct vm_operations_struct flink_vm_ops = {
+	.open  = flink_vm_open,
+	.close = flink_vm_close,
+};
+
+int flink_mmap(struct file* f, struct vm_area_struct* vma) {
+	struct flink_private_data* pdata = (struct flink_private_data*)(f->private_data);
+	struct flink_subdevice* subdev;
+	struct flink_device* fdev;
+	phys_addr_t phys;
+	u32 start;
+	unsigned long len;
+	int error;
+	unsigned long size = vma->vm_end - vma->vm_start;
+	#if defined(DBG)
+		printk(KERN_DEBUG "[%s] mmap call...", MODULE_NAME);
+	#endif
+	if(pdata == NULL || pdata->current_subdevice == NULL) {
+		return -EINVAL;
+	}
+	subdev = pdata->current_subdevice;
+	fdev = subdev->parent;
+	if(fdev->bus_ops->phys_address == NULL) {
+		#if defined(DBG)
+			printk(KERN_DEBUG "  -> Bus does not support memory mapping");
+		#endif
+		return -ENODEV;
+	}
+	phys = fdev->bus_ops->phys_address(fdev);
+	if(phys & ~PAGE_MASK) {
+		#if defined(DBG)
+			printk(KERN_DEBUG "  -> Physical base address 0x%llx is not page aligned", (unsigned long long)phys);
+		#endif
+		return -ENODEV;
+	}
+	// a page must not contain registers of other subdevices
+	if((subdev->base_addr & ~PAGE_MASK) || (subdev->mem_size & ~PAGE_MASK)) {
+		#if defined(DBG)
+			printk(KERN_DEBUG "  -> Subdevice %u (0x%x, %u bytes) is not page aligned", subdev->id, subdev->base_addr, subdev->mem_size);
+		#endif
+		return -EINVAL;
+	}
+	start = subdev->base_addr;
+	len = subdev->mem_size;
+	if(vma->vm_pgoff != 0 || size > len) {
+		#if defined(DBG)
+			printk(KERN_DEBUG "  -> Requested mapping exceeds subdevice: offset 0x%lx, %lu bytes", vma->vm_pgoff << PAGE_SHIFT, size);
+		#endif
+		return -EINVAL;
+	}
+	
+	// counted before the ownership is checked again, flink_select_subdevice() does it the other way round
+	atomic_inc(&(subdev->nof_mappings));
+	smp_mb__after_atomic();
+	if(!flink_subdevice_accessible(subdev, pdata)) {
+		atomic_dec(&(subdev->nof_mappings));
+		return -EBUSY;
+	}
+	vma->vm_page_prot = pgprot_noncached(vma->vm_page_prot);
+	#if defined(DBG)
+		printk(KERN_DEBUG "  -> Mapping 0x%llx (%lu bytes) of device %u/%u", (unsigned long long)(phys + start), size, fdev->id, subdev->id);
+	#endif
+	error = io_remap_pfn_range(vma, vma->vm_start, (phys + start) >> PAGE_SHIFT, size, vma->vm_page_prot);
+	if(error) {
+		atomic_dec(&(subdev->nof_mappings));
+		return error;
+	}
+	vma->vm_private_data = subdev;
+	vma->vm_ops = &flink_vm_ops;
+	return 0;
+}
+
+/**
+ * flink_fsync() - waits until all previous register accesses are completed
+ *
+ * Same as ioctl FLUSH, user space can use it to order a sequence of relaxed accesses
+ * and to wait for the queued writes of write-behind files.
+ */
+int flink_fsync(struct file* f, loff_t start, loff_t end, int datasync) {
+	struct flink_private_data* pdata = (struct flink_private_data*)(f->private_data);
+	#if defined(DBG)
+		printk(KERN_DEBUG "[%s] fsync call...", MODULE_NAME);
+	#endif
+	if(pdata == NULL) {
+		return -EINVAL;
+	}
+	return flink_sync(pdata);
+}
+
+/**
+ * flink_poll() - reports if IRQ events can be read
+ *
+ * Register accesses never block, so files which are not in event mode are
+ * always readable and writable.
+ */
+__poll_t flink_poll(struct file* f, struct poll_table_struct* wait) {
+	struct flink_private_data* pdata = (struct flink_private_data*)(f->private_data);
+	struct flink_event_queue* q = (pdata != NULL) ? smp_load_acquire(&(pdata->events)) : NULL;
+	if(q == NULL) {
+		return EPOLLIN | EPOLLRDNORM | EPOLLOUT | EPOLLWRNORM;
+	}
+	poll_wait(f, &(q->wait), wait);
+	return kfifo_is_empty(&(q->fifo)) ? 0 : (EPOLLIN | EPOLLRDNORM);
+}
+
 loff_t flink_llseek(struct file* f, loff_t off, int whence) {
 	struct flink_private_data* pdata = (struct flink_private_data*)(f->private_data);
 	#if defined(DBG)
@@ -815,6 +3880,12 @@ struct file_operations flink_fops = {
 	.read           = flink_read,
 	.write          = flink_write,
 	.unlocked_ioctl = flink_ioctl,
+	.mmap           = flink_mmap,
+	.fsync          = flink_fsync,
+	.poll           = flink_poll,
+#if defined(FLINK_URING_CMD)
+	.uring_cmd      = flink_uring_cmd,
+#endif
 	.llseek         = flink_llseek
 };
 
@@ -822,8 +3893,38 @@ struct file_operations flink_fops = {
 static int __init flink_init(void) {
 	int error = 0;
 	
+	// Allocate one char dev region for all devices and subdevices
+	error = alloc_chrdev_region(&flink_devt, 0, MAX_NOF_DEVICES * MINORS_PER_DEVICE, SYSFS_CLASS_NAME);
+	if(error) {
+		printk(KERN_ERR "[%s] Allocation of char dev region failed!", MODULE_NAME);
+		goto alloc_chrdev_region_failed;
+	}
+	
 	// Create sysfs class
 	sysfs_class = class_create(THIS_MODULE, SYSFS_CLASS_NAME);
+	if(IS_ERR(sysfs_class)) {
+		printk(KERN_ERR "[%s] Creation of sysfs class failed!", MODULE_NAME);
+		error = PTR_ERR(sysfs_class);
+		goto class_create_failed;
+	}
+	
+	// Create workqueue for triggered sequencer programs
+	flink_seq_wq = alloc_workqueue("flink_seq", WQ_UNBOUND | WQ_HIGHPRI, 0);
+	if(flink_seq_wq == NULL) {
+		printk(KERN_ERR "[%s] Creation of sequencer workqueue failed!", MODULE_NAME);
+		error = -ENOMEM;
+		goto alloc_seq_workqueue_failed;
+	}
+	
+#if defined(FLINK_URING_CMD)
+	// Create workqueue for asynchronous register accesses
+	flink_uring_wq = alloc_workqueue("flink_uring", WQ_UNBOUND, 0);
+	if(flink_uring_wq == NULL) {
+		printk(KERN_ERR "[%s] Creation of io_uring workqueue failed!", MODULE_NAME);
+		error = -ENOMEM;
+		goto alloc_workqueue_failed;
+	}
+#endif
 	
 	// ---- All done ----
 	printk(KERN_INFO "[%s] Module sucessfully loaded\n", MODULE_NAME);
@@ -831,21 +3932,119 @@ static int __init flink_init(void) {
 	return 0;
 
 	// ---- ERROR HANDLING ----
-	
+#if defined(FLINK_URING_CMD)
+alloc_workqueue_failed:
+	destroy_workqueue(flink_seq_wq);
+#endif
+
+alloc_seq_workqueue_failed:
+	class_destroy(sysfs_class);
+
+class_create_failed:
+	unregister_chrdev_region(flink_devt, MAX_NOF_DEVICES * MINORS_PER_DEVICE);
+
+alloc_chrdev_region_failed:
 	return error;
 }
 module_init(flink_init);
 
 // ############ Cleanup ############
 static void __exit flink_exit(void) {
-	// Destroy sysfs class
+#if defined(FLINK_URING_CMD)
+	destroy_workqueue(flink_uring_wq);
+#endif
+	destroy_workqueue(flink_seq_wq);
+	rcu_barrier();	// deferred frees of IRQ subscriptions run code of this module
+	
+	// Destroy sysfs class and free char dev region
 	class_destroy(sysfs_class);
+	unregister_chrdev_region(flink_devt, MAX_NOF_DEVICES * MINORS_PER_DEVICE);
+	idr_destroy(&device_idr);
 	
 	// ---- All done ----
 	printk(KERN_INFO "[%s] Module sucessfully unloaded\n", MODULE_NAME);
 }
 module_exit(flink_exit);
 
+// ############ sysfs attributes ############
+
+static ssize_t read_coalesce_us_show(struct device* dev, struct device_attribute* attr, char* buf) {
+	struct flink_device* fdev = dev_get_drvdata(dev);
+	return scnprintf(buf, PAGE_SIZE, "%llu\n", (unsigned long long)div_u64(READ_ONCE(fdev->coalesce.window_ns), NSEC_PER_USEC));
+}
+
+static ssize_t read_coalesce_us_store(struct device* dev, struct device_attribute* attr, const char* buf, size_t count) {
+	struct flink_device* fdev = dev_get_drvdata(dev);
+	unsigned int us;
+	int error = kstrtouint(buf, 0, &us);
+	if(error) {
+		return error;
+	}
+	if(us > READ_COALESCE_MAX_US) {
+		return -EINVAL;
+	}
+	WRITE_ONCE(fdev->coalesce.window_ns, (u64)us * NSEC_PER_USEC);
+	#if defined(DBG)
+		printk(KERN_DEBUG "[%s] Read coalescing window of device #%u set to %u us", MODULE_NAME, fdev->id, us);
+	#endif
+	return count;
+}
+static DEVICE_ATTR_RW(read_coalesce_us);
+
+static ssize_t irq_moderation_us_show(struct device* dev, struct device_attribute* attr, char* buf) {
+	struct flink_device* fdev = dev_get_drvdata(dev);
+	return scnprintf(buf, PAGE_SIZE, "%llu\n", (unsigned long long)div_u64(READ_ONCE(fdev->irq_window_ns), NSEC_PER_USEC));
+}
+
+static ssize_t irq_moderation_us_store(struct device* dev, struct device_attribute* attr, const char* buf, size_t count) {
+	struct flink_device* fdev = dev_get_drvdata(dev);
+	unsigned int us;
+	int error = kstrtouint(buf, 0, &us);
+	if(error) {
+		return error;
+	}
+	if(us > IRQ_MODERATION_MAX_US) {
+		return -EINVAL;
+	}
+	WRITE_ONCE(fdev->irq_window_ns, (u64)us * NSEC_PER_USEC);
+	#if defined(DBG)
+		printk(KERN_DEBUG "[%s] IRQ moderation window of device #%u set to %u us", MODULE_NAME, fdev->id, us);
+	#endif
+	return count;
+}
+static DEVICE_ATTR_RW(irq_moderation_us);
+
+static ssize_t irq_budget_show(struct device* dev, struct device_attribute* attr, char* buf) {
+	struct flink_device* fdev = dev_get_drvdata(dev);
+	return scnprintf(buf, PAGE_SIZE, "%u\n", READ_ONCE(fdev->irq_budget));
+}
+
+static ssize_t irq_budget_store(struct device* dev, struct device_attribute* attr, const char* buf, size_t count) {
+	struct flink_device* fdev = dev_get_drvdata(dev);
+	unsigned int budget;
+	int error = kstrtouint(buf, 0, &budget);
+	if(error) {
+		return error;
+	}
+	if(budget == 0) {
+		return -EINVAL;
+	}
+	WRITE_ONCE(fdev->irq_budget, budget);
+	#if defined(DBG)
+		printk(KERN_DEBUG "[%s] IRQ moderation budget of device #%u set to %u", MODULE_NAME, fdev->id, budget);
+	#endif
+	return count;
+}
+static DEVICE_ATTR_RW(irq_budget);
+
+static struct attribute* flink_device_attrs[] = {
+	&dev_attr_read_coalesce_us.attr,
+	&dev_attr_irq_moderation_us.attr,
+	&dev_attr_irq_budget.attr,
+	NULL
+};
+ATTRIBUTE_GROUPS(flink_device);
+
 // ############ Device and module handling functions ############
 
 /*******************************************************************
@@ -854,62 +4053,97 @@ module_exit(flink_exit);
  *                                                                 *
  *******************************************************************/
 
+// releases the sysfs device of the device node after the char device and all open inodes dropped it
+static void flink_sysfs_device_release(struct device* dev) {
+	struct flink_device* fdev = dev_get_drvdata(dev);
+	kfree(dev);
+	flink_device_put(fdev);
+}
+
 /**
- * create_device_node() - creates a device node for a flink device
- * @fdev: the flink device to create a device node for
+ * create_device_node() - creates the device nodes for a flink device
+ * @fdev: the flink device to create the device nodes for
+ *
+ * Besides the device node 'flinkN' a node 'flinkN.M' is created for every
+ * subdevice M. Opening a subdevice node selects the subdevice permanently.
+ * Every device owns MINORS_PER_DEVICE minors of the char dev region, starting
+ * at id * MINORS_PER_DEVICE. The first one belongs to the device node, minor
+ * M+1 to subdevice M.
+ * The char device is a child of the sysfs device of the device node, which
+ * holds a reference to the flink device. So the flink device is not freed
+ * before the last inode of one of its nodes dropped the char device.
  */
 static int create_device_node(struct flink_device* fdev) {
-	static unsigned int dev_counter = 0;
 	int error = 0;
-	dev_t dev;
+	dev_t dev = MKDEV(MAJOR(flink_devt), MINOR(flink_devt) + fdev->id * MINORS_PER_DEVICE);
+	struct flink_subdevice* subdev;
+	struct device* sysfs_device;
 	
-	// Allocate, register and initialize char device
-	error = alloc_chrdev_region(&dev, dev_counter, 1, MODULE_NAME);
-	if(error) {
-		printk(KERN_ERR "[%s] Allocation of char dev region failed!", MODULE_NAME);
-		goto alloc_chardev_region_failed;
+	sysfs_device = kzalloc(sizeof(*sysfs_device), GFP_KERNEL);
+	if(sysfs_device == NULL) {
+		return -ENOMEM;
 	}
-	fdev->char_device = cdev_alloc();
-	if(fdev->char_device == NULL) {
-		printk(KERN_ERR "[%s] Allocation of char dev failed!", MODULE_NAME);
-		goto cdev_alloc_failed;
+	device_initialize(sysfs_device);
+	sysfs_device->class = sysfs_class;
+	sysfs_device->devt = dev;
+	sysfs_device->groups = flink_device_groups;
+	sysfs_device->release = flink_sysfs_device_release;
+	dev_set_drvdata(sysfs_device, fdev);
+	kref_get(&(fdev->refcount));	// dropped by flink_sysfs_device_release()
+	error = dev_set_name(sysfs_device, "flink%u", fdev->id);
+	if(error) {
+		goto device_add_failed;
 	}
-	cdev_init(fdev->char_device, &flink_fops);
-	fdev->char_device->owner = THIS_MODULE;
-	error = cdev_add(fdev->char_device, dev, 1);
+	
+	// Initialize and register char device, like cdev_device_add() but for the minors of all nodes
+	cdev_init(&(fdev->char_device), &flink_fops);
+	fdev->char_device.owner = THIS_MODULE;
+	cdev_set_parent(&(fdev->char_device), &(sysfs_device->kobj));
+	error = cdev_add(&(fdev->char_device), dev, 1 + fdev->nof_subdevices);
 	if(error) {
 		printk(KERN_ERR "[%s] Adding the char dev to the system failed!", MODULE_NAME);
-		goto cdev_add_failed;
+		goto device_add_failed;
 	}
 	
 	// create device node
-	fdev->sysfs_device = device_create(sysfs_class, NULL, dev, NULL, "flink%u", dev_counter);
-	if(IS_ERR(fdev->sysfs_device)) {
+	error = device_add(sysfs_device);
+	if(error) {
 		printk(KERN_ERR "[%s] Creation of sysfs device failed!", MODULE_NAME);
-		goto device_create_failed;
+		cdev_del(&(fdev->char_device));
+		goto device_add_failed;
 	}
+	fdev->sysfs_device = sysfs_device;
 	
 	#if defined(DBG)
-		printk(KERN_DEBUG "[%s] Device node created: flink%u", MODULE_NAME, dev_counter);
+		printk(KERN_DEBUG "[%s] Device node created: flink%u", MODULE_NAME, fdev->id);
 	#endif
 	
-	dev_counter++;
+	// create subdevice nodes
+	list_for_each_entry(subdev, &(fdev->subdevices), list) {
+		subdev->sysfs_device = device_create(sysfs_class, fdev->sysfs_device, MKDEV(MAJOR(dev), MINOR(dev) + 1 + subdev->id), NULL, "flink%u.%u", fdev->id, subdev->id);
+		if(IS_ERR(subdev->sysfs_device)) {
+			printk(KERN_ERR "[%s] Creation of sysfs device for subdevice %u failed!", MODULE_NAME, subdev->id);
+			error = PTR_ERR(subdev->sysfs_device);
+			goto subdevice_create_failed;
+		}
+	}
 	
 	return 0;
 	
 	// Cleanup on error
-device_create_failed:
-	cdev_del(fdev->char_device);
-		
-cdev_add_failed:
-	fdev->char_device = NULL;
-
-cdev_alloc_failed:
-	unregister_chrdev_region(dev, 1);
-		
-alloc_chardev_region_failed:
-	// nothing to do
-		
+subdevice_create_failed:
+	list_for_each_entry(subdev, &(fdev->subdevices), list) {
+		if(!IS_ERR_OR_NULL(subdev->sysfs_device)) {
+			device_destroy(sysfs_class, MKDEV(MAJOR(dev), MINOR(dev) + 1 + subdev->id));
+		}
+		subdev->sysfs_device = NULL;
+	}
+	device_del(sysfs_device);
+	cdev_del(&(fdev->char_device));
+	fdev->sysfs_device = NULL;
+	
+device_add_failed:
+	put_device(sysfs_device);
 	return error;
 }
 
@@ -927,6 +4161,7 @@ static unsigned int scan_for_subdevices(struct flink_device* fdev) {
 	u32 current_function = 0;
 	u32 current_mem_size = 0;
 	u32 total_mem_size = 0;
+	u32 header[SUB_HEADER_SIZE / sizeof(u32)];
 	struct flink_subdevice* new_subdev;
 	
 	#if defined(DBG)
@@ -935,8 +4170,13 @@ static unsigned int scan_for_subdevices(struct flink_device* fdev) {
 		printk(KERN_DEBUG "  -> Last valid address: 0x%x", last_address);
 	#endif
 	while(current_address < last_address && subdevice_counter < MAX_NOF_SUBDEVICES) {
-		current_function = (fdev->bus_ops->read32(fdev, current_address + SUBDEV_FUNCTION_OFFSET));
-		current_mem_size = fdev->bus_ops->read32(fdev, current_address + SUBDEV_SIZE_OFFSET);
+		// Read the whole subdevice header with one block transfer
+		if(flink_bus_read_block(fdev, current_address, header, ARRAY_SIZE(header), FLINK_BLOCK_INCREMENT) < 0) {
+			printk(KERN_ERR "[%s] Reading subdevice header at 0x%x failed!", MODULE_NAME, current_address);
+			break;
+		}
+		current_function = header[SUBDEV_FUNCTION_OFFSET / sizeof(u32)];
+		current_mem_size = header[SUBDEV_SIZE_OFFSET / sizeof(u32)];
 
 		#if defined(DBG)
 			printk(KERN_DEBUG "[%s] subdevice size: 0x%x (current address: 0x%x)\n", MODULE_NAME, current_mem_size, current_address);
@@ -951,16 +4191,16 @@ static unsigned int scan_for_subdevices(struct flink_device* fdev) {
 			new_subdev->function_version = (u8)(current_function & 0xFF);
 			new_subdev->base_addr = current_address;
 			new_subdev->mem_size = current_mem_size;
-			new_subdev->nof_channels = fdev->bus_ops->read32(fdev, current_address + SUBDEV_NOFCHANNELS_OFFSET);
-			new_subdev->unique_id = fdev->bus_ops->read32(fdev, current_address + SUBDEV_UNIQUE_ID_OFFSET);
+			new_subdev->nof_channels = header[SUBDEV_NOFCHANNELS_OFFSET / sizeof(u32)];
+			new_subdev->unique_id = header[SUBDEV_UNIQUE_ID_OFFSET / sizeof(u32)];
 			
-			// Add subdevice to flink device
+			// Add subdevice to flink device, header reads are answered from these fields
 			flink_subdevice_add(fdev, new_subdev);
 			subdevice_counter++;
 			
 			// if subdevice is info subdevice -> read memory length
 			if(new_subdev->function_id == INFO_FUNCTION_ID) {
-				total_mem_size = fdev->bus_ops->read32(fdev, current_address + MAIN_HEADER_SIZE + SUB_HEADER_SIZE);
+				total_mem_size = flink_bus_read32(fdev, current_address + MAIN_HEADER_SIZE + SUB_HEADER_SIZE);
 				last_address = total_mem_size - 1;
 				#if defined(DBG)
 					printk(KERN_DEBUG "[%s] Info subdevice found: total memory length=0x%x", MODULE_NAME, total_mem_size);
@@ -982,48 +4222,189 @@ static unsigned int scan_for_subdevices(struct flink_device* fdev) {
 	return subdevice_counter;
 }
 
-// irq handler do not call this function directly. Only register it with request_irq()
-static irqreturn_t flink_threaded_irq_handler(int irq, void *dev_id) {
-    struct siginfo info;
-	struct flink_irq_data* irq_data = (struct flink_irq_data*)(dev_id);
-	struct flink_process_data* signal_data;
-
-	#if defined(DBG_IRQ)
-		printk(KERN_DEBUG "[%s] IRQ nr: %lu rised", MODULE_NAME, irq);
-	#endif
+/**
+ * flink_irq_notify() - queues an event for the subscribers of an IRQ and signals its eventfds and programs
+ * @irq_data: the IRQ, the caller holds rcu_read_lock()
+ * @count: number of occurrences notified at once
+ * @seq: sequence number of the last of these occurrences
+ * @timestamp: time of the last of these occurrences
+ *
+ * Safe in hard interrupt context.
+ */
+static void flink_irq_notify(struct flink_irq_data* irq_data, u32 count, u32 seq, u64 timestamp) {
+	struct flink_program* prog;
+	struct flink_irq_eventfd* efd;
+	struct flink_irq_subscriber* sub;
+	struct flink_irq_event_t event;
 
-	if (unlikely(irq != irq_data->irq_nr_with_offset)) {
-		#if defined(DBG_IRQ)
-			printk(KERN_DEBUG "  -> IRQ nr: %lu calld the wrong handler (Handler irq nr: %lu)", irq, irq_data->irq_nr_with_offset);
-		#endif
-		return IRQ_NONE;
+	event.irq_nr = irq_data->irq_nr;
+	event.count = count;
+	event.seq = seq;
+	event.reserved = 0;
+	event.timestamp_ns = timestamp;
+	list_for_each_entry_rcu(sub, &(irq_data->subscribers), list) {
+		kfifo_in_spinlocked(&(sub->queue->fifo), &event, 1, &(sub->queue->lock));	// a full queue drops the event, the reader sees a gap in seq
+		wake_up_interruptible(&(sub->queue->wait));
+	}
+	list_for_each_entry_rcu(efd, &(irq_data->eventfds), list) {
+		flink_eventfd_signal(efd->ctx, count);	// the counter adds up to the exact number of interrupts
 	}
+	list_for_each_entry_rcu(prog, &(irq_data->programs), irq_node) {
+		queue_work(flink_seq_wq, &(prog->work));
+	}
+}
+
+/**
+ * flink_irq_send_signals() - sends the signal of an IRQ to all registered processes
+ * @irq_data: the IRQ, the caller holds rcu_read_lock()
+ * @count: number of interrupts notified by this signal, passed in si_int
+ */
+static void flink_irq_send_signals(struct flink_irq_data* irq_data, u32 count) {
+    struct siginfo info;
+	struct flink_process_data* signal_data;
 
 	// prepare siginfo to save time
 	memset(&info, 0, sizeof(info));
 	info.si_code = SI_QUEUE;
 	info.si_signo = irq_data->signal_nr_with_offset;
+	info.si_int = count;
 	
-	// critical section
-	{
-		spin_lock_bh(&(irq_data->irq_lock));
-		list_for_each_entry(signal_data, &(irq_data->flink_process_data), list) {
-			if(signal_data->user_task != NULL) {
-				/* Send the signal */
-				#if defined(DBG_IRQ) 
-					int err = send_sig_info(irq_data->signal_nr_with_offset, (struct kernel_siginfo *) &info, signal_data->user_task);
-					if(err < 0) {
-						printk(KERN_WARNING "  -> Error while sending signal: %lu to userspace pid: %lu. Error nr: %lu", MODULE_NAME, irq_data->signal_nr_with_offset, signal_data->user_task->pid, err);
-					} else {
-						printk(KERN_DEBUG "  -> Successfully send signal: %lu to userspace pid: %lu", MODULE_NAME, irq_data->signal_nr_with_offset, signal_data->user_task->pid);
-					}
-				#else
-					send_sig_info(irq_data->signal_nr_with_offset, (struct kernel_siginfo *) &info, signal_data->user_task);
-				#endif
-			}
+	list_for_each_entry_rcu(signal_data, &(irq_data->flink_process_data), list) {
+		if(signal_data->user_task != NULL) {
+			/* Send the signal */
+			#if defined(DBG_IRQ) 
+				int err = send_sig_info(irq_data->signal_nr_with_offset, (struct kernel_siginfo *) &info, signal_data->user_task);
+				if(err < 0) {
+					printk(KERN_WARNING "  -> Error while sending signal: %lu to userspace pid: %lu. Error nr: %lu", MODULE_NAME, irq_data->signal_nr_with_offset, signal_data->user_task->pid, err);
+				} else {
+					printk(KERN_DEBUG "  -> Successfully send signal: %lu to userspace pid: %lu", MODULE_NAME, irq_data->signal_nr_with_offset, signal_data->user_task->pid);
+				}
+			#else
+				send_sig_info(irq_data->signal_nr_with_offset, (struct kernel_siginfo *) &info, signal_data->user_task);
+			#endif
 		}
-		spin_unlock_bh(&(irq_data->irq_lock));
 	}
+}
+
+/**
+ * flink_irq_moderate() - counts an occurrence of an IRQ and decides whether it is notified in a batch
+ * @irq_data: the IRQ, the caller holds moderation_lock
+ * @now: time of the occurrence
+ *
+ * Once more than irq_budget occurrences fall into one moderation window, the IRQ is moderated: every
+ * occurrence only increments pending and poll_timer notifies them once per window.
+ * Returns true if the occurrence is left to poll_timer.
+ */
+static bool flink_irq_moderate(struct flink_irq_data* irq_data, u64 now) {
+	u64 window = READ_ONCE(irq_data->fdev->irq_window_ns);
+	if(irq_data->moderated) {
+		irq_data->pending++;
+		return true;
+	}
+	if(window == 0) {
+		return false;
+	}
+	if(now - irq_data->window_start >= window) {
+		irq_data->window_start = now;
+		irq_data->window_count = 0;
+	}
+	if(++irq_data->window_count <= READ_ONCE(irq_data->fdev->irq_budget)) {
+		return false;
+	}
+	irq_data->moderated = true;
+	irq_data->pending = 1;
+	hrtimer_start(&(irq_data->poll_timer), ns_to_ktime(window), HRTIMER_MODE_REL_SOFT);
+	return true;
+}
+
+// moderation poll timer, notifies the occurrences of a moderated IRQ counted during the last window
+static enum hrtimer_restart flink_irq_poll(struct hrtimer* timer) {
+	struct flink_irq_data* irq_data = container_of(timer, struct flink_irq_data, poll_timer);
+	u64 window = READ_ONCE(irq_data->fdev->irq_window_ns);
+	unsigned long flags;
+	u64 timestamp;
+	u32 count, seq;
+	bool busy;
+
+	raw_spin_lock_irqsave(&(irq_data->moderation_lock), flags);
+	count = irq_data->pending;
+	seq = irq_data->seq;
+	timestamp = irq_data->timestamp;
+	irq_data->pending = 0;
+	raw_spin_unlock_irqrestore(&(irq_data->moderation_lock), flags);
+
+	if(count > 0) {
+		rcu_read_lock();
+		flink_irq_send_signals(irq_data, count);
+		flink_irq_notify(irq_data, count, seq, timestamp);
+		rcu_read_unlock();
+	}
+	busy = window > 0 && count >= READ_ONCE(irq_data->fdev->irq_budget);
+
+	// leave moderation only after the last batch is notified, so that notifications stay in order
+	raw_spin_lock_irqsave(&(irq_data->moderation_lock), flags);
+	if(!busy && irq_data->pending == 0) {
+		irq_data->moderated = false;
+		irq_data->window_start = ktime_get_ns();
+		irq_data->window_count = 0;
+	}
+	busy = irq_data->moderated;
+	raw_spin_unlock_irqrestore(&(irq_data->moderation_lock), flags);
+	if(!busy) {
+		return HRTIMER_NORESTART;
+	}
+	hrtimer_forward_now(timer, ns_to_ktime(window > 0 ? window : NSEC_PER_USEC));
+	return HRTIMER_RESTART;
+}
+
+// primary irq handler, do not call this function directly. Only register it with request_threaded_irq()
+static irqreturn_t flink_irq_handler(int irq, void *dev_id) {
+	struct flink_irq_data* irq_data = (struct flink_irq_data*)(dev_id);
+	u64 now;
+	bool signals;
+
+	if (unlikely(irq != irq_data->irq_nr_with_offset)) {
+		return IRQ_NONE;
+	}
+	now = ktime_get_ns();
+	raw_spin_lock(&(irq_data->moderation_lock));
+	irq_data->timestamp = now;
+	irq_data->seq++;
+	if(flink_irq_moderate(irq_data, now)) {
+		raw_spin_unlock(&(irq_data->moderation_lock));
+		return IRQ_HANDLED;
+	}
+	raw_spin_unlock(&(irq_data->moderation_lock));
+
+	// IRQF_ONESHOT: seq and timestamp stay unchanged until the thread has finished
+	irq_data->notified = READ_ONCE(irq_data->hard_irq);
+	if(!irq_data->notified) {
+		return IRQ_WAKE_THREAD;
+	}
+
+	// FLINK_IRQ_HARD: notify without waking the thread, which is only needed to send signals
+	rcu_read_lock();
+	flink_irq_notify(irq_data, 1, irq_data->seq, now);
+	signals = !list_empty(&(irq_data->flink_process_data));
+	rcu_read_unlock();
+	return signals ? IRQ_WAKE_THREAD : IRQ_HANDLED;
+}
+
+// irq thread, do not call this function directly. Only register it with request_threaded_irq()
+static irqreturn_t flink_threaded_irq_handler(int irq, void *dev_id) {
+	struct flink_irq_data* irq_data = (struct flink_irq_data*)(dev_id);
+
+	#if defined(DBG_IRQ)
+		printk(KERN_DEBUG "[%s] IRQ nr: %lu rised", MODULE_NAME, irq);
+	#endif
+
+	// the lists are only read here, ioctl callers change them under lock_for_ioctl and free entries after a grace period
+	rcu_read_lock();
+	flink_irq_send_signals(irq_data, 1);
+	if(!irq_data->notified) {
+		flink_irq_notify(irq_data, 1, irq_data->seq, irq_data->timestamp);
+	}
+	rcu_read_unlock();
 	return IRQ_HANDLED;
 }
 
@@ -1041,6 +4422,7 @@ struct flink_device* flink_device_alloc(void) {
 	struct flink_device* fdev = kmalloc(sizeof(struct flink_device), GFP_KERNEL);
 	if(fdev) {
 		INIT_LIST_HEAD(&(fdev->list));
+		atomic_inc(&nof_live_devices);
 	}
 	return fdev;
 }
@@ -1080,41 +4462,57 @@ void flink_device_init_irq(struct flink_device* fdev,
 	int err = 0;
 	
 	memset(fdev, 0, sizeof(*fdev));
+	kref_init(&(fdev->refcount));
 	INIT_LIST_HEAD(&(fdev->list));
 	INIT_LIST_HEAD(&(fdev->subdevices));
+	flink_write_queue_init(&(fdev->write_queue));
+	spin_lock_init(&(fdev->coalesce.lock));
+	init_waitqueue_head(&(fdev->coalesce.wait));
+	flink_timed_write_init(&(fdev->timed_writes));
+	hash_init(fdev->subdevices_by_function);
+	hash_init(fdev->subdevices_by_unique_id);
 	fdev->bus_ops = bus_ops;
 	fdev->appropriated_module = mod;
 	
 	fdev->irq_offset = irq_offset;
 	fdev->signal_offset = signal_offset;
 	fdev->nof_irqs = nof_irq;
-	INIT_LIST_HEAD(&(fdev->hw_irq_data)); // First dimension static: Second dimension dynamic
+	fdev->irq_budget = IRQ_MODERATION_BUDGET;
 
-	// Create the first dimension of the two-dimensional data structure "flink_irq_sorted_by_irq"
+	// One cacheline aligned entry per IRQ, the IRQ number is the index
 	if(nof_irq > 0){
+		fdev->irqs = kcalloc(nof_irq, sizeof(struct flink_irq_data), GFP_KERNEL);
+		if(unlikely(!fdev->irqs)) {
+			printk(KERN_ERR "[%s] Failed to allocate memory for %lu hw irqs", MODULE_NAME, (long unsigned int)nof_irq);
+			printk(KERN_ERR "  -> Disabled IRQ functionality!!!");
+			fdev->nof_irqs = 0;
+			return;
+		}
 		for(int i = 0; i < nof_irq; i++){
-			irq_data = kzalloc(sizeof(struct flink_irq_data), GFP_KERNEL);
-			if(unlikely(!irq_data)) {
-				printk(KERN_ERR "[%s] Failed to allocate memory for hw irq: %lu", MODULE_NAME, (long unsigned int)irq_offset + i);
-				printk(KERN_ERR "  -> Disabled IRQ functionality!!!");
-				nof_irq = 0;
-				return;
-			}
-			INIT_LIST_HEAD(&(irq_data->list));
+			irq_data = &(fdev->irqs[i]);
 			INIT_LIST_HEAD(&(irq_data->flink_process_data));
+			INIT_LIST_HEAD(&(irq_data->programs));
+			INIT_LIST_HEAD(&(irq_data->eventfds));
+			INIT_LIST_HEAD(&(irq_data->subscribers));
 			irq_data->irq_nr = i;
 			irq_data->signal_count = 0;
 			irq_data->irq_nr_with_offset = irq_offset + i;
-			spin_lock_init(&(irq_data->irq_lock));
 			mutex_init(&(irq_data->lock_for_ioctl));
-			list_add(&(irq_data->list), &(fdev->hw_irq_data));
+			irq_data->fdev = fdev;
+			raw_spin_lock_init(&(irq_data->moderation_lock));
+			flink_hrtimer_setup(&(irq_data->poll_timer), flink_irq_poll, CLOCK_MONOTONIC, HRTIMER_MODE_REL_SOFT);
 
-			// register a threaded irq handler otherwise is occours a problem with the using spinlock
-			err = request_threaded_irq(irq_data->irq_nr_with_offset, NULL, flink_threaded_irq_handler, IRQF_ONESHOT, "flink IRQ Handler", (void*)(irq_data));
+			// the primary handler only timestamps the IRQ unless it is switched to FLINK_IRQ_HARD (SET_IRQ_MODE)
+			err = request_threaded_irq(irq_data->irq_nr_with_offset, flink_irq_handler, flink_threaded_irq_handler, IRQF_ONESHOT, "flink IRQ Handler", (void*)(irq_data));
 			if (unlikely(err < 0)) {
 				printk(KERN_ERR "[%s] Unabel to register IRQ %lu. Error nr: %d", MODULE_NAME, (long unsigned int)irq_data->irq_nr_with_offset, err);
 				printk(KERN_ERR "  -> Disabled IRQ functionality!!!");
-				nof_irq = 0;
+				while(--i >= 0) {
+					free_irq(fdev->irqs[i].irq_nr_with_offset, (void*)(&(fdev->irqs[i])));
+				}
+				kfree(fdev->irqs);
+				fdev->irqs = NULL;
+				fdev->nof_irqs = 0;
 				return;
 			}
 		}
@@ -1131,12 +4529,25 @@ void flink_device_init_irq(struct flink_device* fdev,
  * @return int: A negative error code is returned on failure.
  */
 int flink_device_add(struct flink_device* fdev) {
-	static unsigned int dev_counter = 0;
 	unsigned int nof_subdevices = 0;
+	int id;
 	if(fdev != NULL) {
-		// Add device to list
-		fdev->id = dev_counter++;
-		list_add(&(fdev->list), &device_list);
+		// Assign id and add device to list
+		mutex_lock(&device_registry_lock);
+		id = idr_alloc(&device_idr, fdev, 0, MAX_NOF_DEVICES, GFP_KERNEL);
+		if(id < 0) {
+			mutex_unlock(&device_registry_lock);
+			printk(KERN_ERR "[%s] No free device id available!", MODULE_NAME);
+			return id;
+		}
+		if(flink_bus_type_get(fdev->bus_ops) < 0) {
+			idr_remove(&device_idr, id);
+			mutex_unlock(&device_registry_lock);
+			return -ENOMEM;
+		}
+		fdev->id = id;
+		list_add_tail_rcu(&(fdev->list), &device_list);
+		mutex_unlock(&device_registry_lock);
 		#if defined(DBG)
 			printk(KERN_DEBUG "[%s] Device with id '%u' added to device list.", MODULE_NAME, fdev->id);
 		#endif
@@ -1163,16 +4574,41 @@ int flink_device_add(struct flink_device* fdev) {
 int flink_device_remove(struct flink_device* fdev) {
 	if(fdev != NULL) {
 		
-		// Remove device from list
-		list_del(&(fdev->list));
+		// Remove device from list and release its id
+		mutex_lock(&device_registry_lock);
+		list_del_rcu(&(fdev->list));
+		idr_remove(&device_idr, fdev->id);
+		mutex_unlock(&device_registry_lock);
+		synchronize_rcu();
 		#if defined(DBG)
 			printk(KERN_DEBUG "[%s] Device with id '%u' removed frome device list.", MODULE_NAME, fdev->id);
 		#endif
 		
-		// Destroy device node and free char dev region
-		device_destroy(sysfs_class, fdev->char_device->dev);
-		cdev_del(fdev->char_device);
-		unregister_chrdev_region(fdev->char_device->dev, 1);
+		// Destroy device nodes
+		if(fdev->sysfs_device != NULL) {
+			struct flink_subdevice* subdev;
+			dev_t dev = fdev->char_device.dev;
+			list_for_each_entry(subdev, &(fdev->subdevices), list) {
+				if(subdev->sysfs_device != NULL) {
+					device_destroy(sysfs_class, MKDEV(MAJOR(dev), MINOR(dev) + 1 + subdev->id));
+					subdev->sysfs_device = NULL;
+				}
+			}
+			device_del(fdev->sysfs_device);
+			cdev_del(&(fdev->char_device));
+			put_device(fdev->sysfs_device);	// freed with the last open inode of the char device
+			fdev->sysfs_device = NULL;
+		}
+		
+		// Execute the remaining queued writes while the bus is still available, pending timed writes are dropped
+		flush_work(&(fdev->write_queue.work));
+		hrtimer_cancel(&(fdev->timed_writes.timer));
+		flush_work(&(fdev->timed_writes.work));
+		
+		// Register accesses of other devices must not be dispatched to this bus any more
+		mutex_lock(&device_registry_lock);
+		flink_bus_type_put(fdev->bus_ops);
+		mutex_unlock(&device_registry_lock);
 		
 		return 0;
 	}
@@ -1180,56 +4616,82 @@ int flink_device_remove(struct flink_device* fdev) {
 }
 
 /**
- * @brief Deletes a flink device and frees the allocated memory. All subdevices will be deleted,
- * using flink_subdevice_remove() and flink_subdevice_delete() as well as the whole irq structure.
+ * flink_device_release() - frees a flink device after its last reference was dropped
+ * @ref: the refcount of the device
+ *
+ * All subdevices are deleted using flink_subdevice_remove() and flink_subdevice_delete()
+ * as well as the whole irq structure.
+ */
+static void flink_device_release(struct kref* ref) {
+	struct flink_device* fdev = container_of(ref, struct flink_device, refcount);
+	struct flink_subdevice* sdev;
+	struct flink_subdevice* sdev_next;
+	struct flink_irq_data* irq_data;
+	struct flink_process_data* signal_data, *signal_data_next;
+	
+	// Remove and delete all subdevices
+	list_for_each_entry_safe(sdev, sdev_next, &(fdev->subdevices), list) {
+		#if defined(DBG)
+			printk(KERN_DEBUG "[%s] Removing and deleting subdevice #%u (from device #%u)", MODULE_NAME, sdev->id, fdev->id);
+		#endif
+		flink_subdevice_remove(sdev);
+		flink_subdevice_delete(sdev);
+	}
+	
+	// remove and delete irq structure with the nested signal structure
+	for(u32 i = 0; i < fdev->nof_irqs; i++) {
+		irq_data = &(fdev->irqs[i]);
+		#if defined(DBG)
+			printk(KERN_DEBUG "  -> Removing and deleting irq structure #%u (from device #%u)", irq_data->irq_nr, fdev->id);
+		#endif
+		list_for_each_entry_safe(signal_data, signal_data_next, &(irq_data->flink_process_data), list) {
+			#if defined(DBG)
+				printk(KERN_DEBUG "  -> Removing and deleting signal structure #%u (from device #%u)", irq_data->signal_nr_with_offset, fdev->id);
+			#endif
+			list_del(&(signal_data->list));
+			kfree(signal_data);
+		}
+	}
+	kfree(fdev->irqs);
+	
+	// Free memory
+	kfree(fdev);
+	atomic_dec(&nof_live_devices);
+}
+
+/**
+ * @brief Drops a reference to a flink device. The device is freed with the last reference.
+ * @param fdev: The flink device, NULL is ignored.
+ */
+void flink_device_put(struct flink_device* fdev) {
+	if(fdev != NULL) {
+		kref_put(&(fdev->refcount), flink_device_release);
+	}
+}
+
+/**
+ * @brief Deletes a flink device. Its IRQs are released immediately, the memory
+ * including all subdevices and the irq structure is freed as soon as no file
+ * of the device is open any more.
  * @param fdev: The flink_device structure to delete. 
  * @return int: A negative error code is returned on failure.
  */
 int flink_device_delete(struct flink_device* fdev) {
 	if(fdev != NULL) {
-		struct flink_subdevice* sdev;
-		struct flink_subdevice* sdev_next;
-		struct flink_irq_data* irq_data, *irq_data_next;
-		struct flink_process_data* signal_data, *signal_data_next;
+		struct flink_irq_data* irq_data;
 		
-		// Remove and delete all subdevices
-		list_for_each_entry_safe(sdev, sdev_next, &(fdev->subdevices), list) {
+		// unregister all IRQs, the handlers must not run once the bus is gone
+		for(u32 i = 0; i < fdev->nof_irqs; i++) {
+			irq_data = &(fdev->irqs[i]);
 			#if defined(DBG)
-				printk(KERN_DEBUG "[%s] Removing and deleting subdevice #%u (from device #%u)", MODULE_NAME, sdev->id, fdev->id);
+				printk(KERN_DEBUG "  -> Releasing irq #%u (from device #%u)", irq_data->irq_nr, fdev->id);
 			#endif
-			flink_subdevice_remove(sdev);
-			flink_subdevice_delete(sdev);
-		}
-
-		// unregister irq and delete the irq related data
-		if(fdev->nof_irqs > 0) {
-			// first, unregister all IRQs to avoid using the spinlock and to avoid a null pointer error if an IRQ is fired.
-			list_for_each_entry_safe(irq_data, irq_data_next, &(fdev->hw_irq_data), list) {
-				#if defined(DBG)
-					printk(KERN_DEBUG "  -> Removing and deleting irq structure #%u (from device #%u)", irq_data->irq_nr, fdev->id);
-				#endif
-				free_irq(irq_data->irq_nr_with_offset, (void*)(irq_data));
-			}
-
-			// remove and delete irq structure with the nested signal structure
-			list_for_each_entry_safe(irq_data, irq_data_next, &(fdev->hw_irq_data), list) {
-				#if defined(DBG)
-					printk(KERN_DEBUG "  -> Removing and deleting irq structure #%u (from device #%u)", irq_data->irq_nr, fdev->id);
-				#endif
-				list_for_each_entry_safe(signal_data, signal_data_next, &(irq_data->flink_process_data), list) {
-					#if defined(DBG)
-						printk(KERN_DEBUG "  -> Removing and deleting signal structure #%u (from device #%u)", irq_data->signal_nr_with_offset, fdev->id);
-					#endif
-					list_del(&(signal_data->list));
-					if(signal_data) kfree(signal_data);
-				}
-				list_del(&(irq_data->list));
-				if(irq_data) kfree(irq_data);
-			}
+			free_irq(irq_data->irq_nr_with_offset, (void*)(irq_data));
+			hrtimer_cancel(&(irq_data->poll_timer));
 		}
-
-		// Free memory
-		kfree(fdev);
+		
+		// Drop the reference of the bus module
+		flink_device_put(fdev);
 		
 		return 0;
 	}
@@ -1239,26 +4701,23 @@ int flink_device_delete(struct flink_device* fdev) {
 /**
  * @brief Get a flink device by its id.
  * @param id: The id of the flink device. 
- * @return flink_device*: Returns the flink device structure with the given id. 
+ * @return flink_device*: Returns the flink device structure with the given id, the caller
+ * has to drop the reference with flink_device_put().
  * NULL is returned if no device is found with the given id.
  */
-struct flink_device* flink_get_device_by_id(u8 id) {
+struct flink_device* flink_get_device_by_id(u32 id) {
 	struct flink_device* fdev;
-	#if defined(DBG)
-		printk(KERN_DEBUG "[%s] Looking for device with id '%u'...", MODULE_NAME, id);
-	#endif
-	list_for_each_entry(fdev, &device_list, list) {
-		if(fdev->id == id) {
-			#if defined(DBG)
-				printk(KERN_DEBUG "[%s] Device with id '%u' found!", MODULE_NAME, id);
-			#endif
-			return fdev;
-		}
+	rcu_read_lock();
+	fdev = idr_find(&device_idr, id);
+	if(fdev != NULL && !kref_get_unless_zero(&(fdev->refcount))) {
+		fdev = NULL;
 	}
+	rcu_read_unlock();
 	#if defined(DBG)
-		printk(KERN_DEBUG "[%s] No device with id '%u' found!", MODULE_NAME, id);
+		if(fdev != NULL) printk(KERN_DEBUG "[%s] Device with id '%u' found!", MODULE_NAME, id);
+		else printk(KERN_DEBUG "[%s] No device with id '%u' found!", MODULE_NAME, id);
 	#endif
-	return NULL;
+	return fdev;
 }
 
 /**
@@ -1268,28 +4727,18 @@ struct flink_device* flink_get_device_by_id(u8 id) {
  * NULL is returned if no suitable device is found.
  */
 struct flink_device* flink_get_device_by_cdev(struct cdev* char_device) {
-	struct flink_device* fdev;
-	#if defined(DBG)
-		printk(KERN_DEBUG "[%s] Looking for device with cdev '%p'...", MODULE_NAME, char_device);
-	#endif
-	list_for_each_entry(fdev, &device_list, list) {
-		if(fdev->char_device == char_device) {
-			#if defined(DBG)
-				printk(KERN_DEBUG "[%s] Device with cdev '%p' found!", MODULE_NAME, char_device);
-			#endif
-			return fdev;
-		}
+	if(char_device == NULL) {
+		return NULL;
 	}
-	#if defined(DBG)
-		printk(KERN_DEBUG "[%s] No device with cdev '%p' found!", MODULE_NAME, char_device);
-	#endif
-	return NULL;
+	return container_of(char_device, struct flink_device, char_device);
 }
 
 /**
  * @brief Get a list with all devices.
  * @return list_head*: Returns a pointer to a list containing
- * all flink devices. The list could be empty.
+ * all flink devices. The list could be empty. Readers which may run
+ * concurrently to flink_device_add() or flink_device_remove() have to
+ * hold rcu_read_lock().
  */
 struct list_head* flink_get_device_list() {
 	return &device_list;
@@ -1303,6 +4752,8 @@ struct flink_subdevice* flink_subdevice_alloc(void) {
 	struct flink_subdevice* fsubdev = kmalloc(sizeof(struct flink_subdevice), GFP_KERNEL);
 	if(fsubdev) {
 		INIT_LIST_HEAD(&(fsubdev->list));
+		INIT_HLIST_NODE(&(fsubdev->function_node));
+		INIT_HLIST_NODE(&(fsubdev->unique_id_node));
 	}
 	return fsubdev;
 }
@@ -1315,6 +4766,11 @@ struct flink_subdevice* flink_subdevice_alloc(void) {
 void flink_subdevice_init(struct flink_subdevice* fsubdev) {
 	memset(fsubdev, 0, sizeof(*fsubdev));
 	INIT_LIST_HEAD(&(fsubdev->list));
+	INIT_HLIST_NODE(&(fsubdev->function_node));
+	INIT_HLIST_NODE(&(fsubdev->unique_id_node));
+	mutex_init(&(fsubdev->rmw_lock));
+	INIT_LIST_HEAD(&(fsubdev->shadow_registers));
+	spin_lock_init(&(fsubdev->cache_lock));
 }
 
 /**
@@ -1331,8 +4787,11 @@ int flink_subdevice_add(struct flink_device* fdev, struct flink_subdevice* fsubd
 		// Set parent pointer
 		fsubdev->parent = fdev;
 		
-		// Add subdevice to device
+		// Add subdevice to device and its lookup tables
 		list_add(&(fsubdev->list), &(fdev->subdevices));
+		fdev->subdevice_table[fsubdev->id] = fsubdev;
+		hash_add(fdev->subdevices_by_function, &(fsubdev->function_node), fsubdev->function_id);
+		hash_add(fdev->subdevices_by_unique_id, &(fsubdev->unique_id_node), fsubdev->unique_id);
 		#if defined(DBG)
 			printk(KERN_DEBUG "[%s] Subdevice with id '%u' added to device with id '%u'.", MODULE_NAME, fsubdev->id, fdev->id);
 			printk(KERN_DEBUG "  -> Function:         0x%x/0x%x/0x%x", fsubdev->function_id, fsubdev->sub_function_id, fsubdev->function_version);
@@ -1358,8 +4817,13 @@ int flink_subdevice_add(struct flink_device* fdev, struct flink_subdevice* fsubd
 int flink_subdevice_remove(struct flink_subdevice* fsubdev) {
 	if(fsubdev != NULL) {
 		
-		// Remove device from list
+		// Remove device from list and lookup tables
 		list_del(&(fsubdev->list));
+		hash_del(&(fsubdev->function_node));
+		hash_del(&(fsubdev->unique_id_node));
+		if(fsubdev->parent != NULL && fsubdev->parent->subdevice_table[fsubdev->id] == fsubdev) {
+			fsubdev->parent->subdevice_table[fsubdev->id] = NULL;
+		}
 		#if defined(DBG)
 			printk(KERN_DEBUG "[%s] Subdevice with id '%u' removed from list.", MODULE_NAME, fsubdev->id);
 		#endif
@@ -1379,8 +4843,17 @@ int flink_subdevice_remove(struct flink_subdevice* fsubdev) {
  */
 int flink_subdevice_delete(struct flink_subdevice* fsubdev) {
 	if(fsubdev != NULL) {
+		struct flink_shadow_register* reg, *reg_next;
+		struct flink_bit_claim* claim, *claim_next;
 		
 		// Free memory
+		list_for_each_entry_safe(reg, reg_next, &(fsubdev->shadow_registers), list) {
+			list_for_each_entry_safe(claim, claim_next, &(reg->claims), list) {
+				kfree(claim);
+			}
+			kfree(reg);
+		}
+		kfree(fsubdev->cache);
 		kfree(fsubdev);
 		
 		return 0;
@@ -1396,21 +4869,57 @@ int flink_subdevice_delete(struct flink_subdevice* fsubdev) {
  * NULL is returned if no subdevice is found with the given id.
  */
 struct flink_subdevice* flink_get_subdevice_by_id(struct flink_device* fdev, u8 id) {
+	if(fdev != NULL) {
+		struct flink_subdevice* subdev = fdev->subdevice_table[id];
+		#if defined(DBG)
+			if(subdev != NULL) printk(KERN_DEBUG "[%s] Subdevice with id '%u' found in device %u!", MODULE_NAME, id, fdev->id);
+			else printk(KERN_DEBUG "[%s] No subdevice with id '%u' found in device %u!", MODULE_NAME, id, fdev->id);
+		#endif
+		return subdev;
+	}
+	return NULL;
+}
+
+/**
+ * @brief Get a flink subdevice by its function id.
+ * @param fdev: The flink device containing the desired flink_subdevice. 
+ * @param function_id: The function id of the subdevice. 
+ * @return flink_subdevice*: Returns the subdevice with the lowest id having the given function id. 
+ * NULL is returned if no subdevice is found with the given function id.
+ */
+struct flink_subdevice* flink_get_subdevice_by_function(struct flink_device* fdev, u16 function_id) {
+	struct flink_subdevice* found = NULL;
 	if(fdev != NULL) {
 		struct flink_subdevice* subdev;
+		hash_for_each_possible(fdev->subdevices_by_function, subdev, function_node, function_id) {
+			if(subdev->function_id == function_id && (found == NULL || subdev->id < found->id)) {
+				found = subdev;
+			}
+		}
 		#if defined(DBG)
-			printk(KERN_DEBUG "[%s] Looking for subdevice with id '%u' in device %u...", MODULE_NAME, id, fdev->id);
+			if(found == NULL) printk(KERN_DEBUG "[%s] No subdevice with function id '0x%x' found!", MODULE_NAME, function_id);
 		#endif
-		list_for_each_entry(subdev, &(fdev->subdevices), list) {
-			if(subdev->id == id) {
-				#if defined(DBG)
-					printk(KERN_DEBUG "[%s] Subdevice with id '%u' found!", MODULE_NAME, id);
-				#endif
+	}
+	return found;
+}
+
+/**
+ * @brief Get a flink subdevice by its unique id.
+ * @param fdev: The flink device containing the desired flink_subdevice. 
+ * @param unique_id: The unique id of the subdevice. 
+ * @return flink_subdevice*: Returns the flink_subdevice structure with the given unique id. 
+ * NULL is returned if no subdevice is found with the given unique id.
+ */
+struct flink_subdevice* flink_get_subdevice_by_unique_id(struct flink_device* fdev, u32 unique_id) {
+	if(fdev != NULL) {
+		struct flink_subdevice* subdev;
+		hash_for_each_possible(fdev->subdevices_by_unique_id, subdev, unique_id_node, unique_id) {
+			if(subdev->unique_id == unique_id) {
 				return subdev;
 			}
 		}
 		#if defined(DBG)
-			printk(KERN_DEBUG "[%s] No subdevice with id '%u' found!", MODULE_NAME, id);
+			printk(KERN_DEBUG "[%s] No subdevice with unique id '0x%x' found!", MODULE_NAME, unique_id);
 		#endif
 	}
 	return NULL;
@@ -1425,23 +4934,52 @@ struct class* flink_get_sysfs_class(void) {
 }
 
 /**
- * @brief Select a subdevice for exclusive access.
- * @param f:  
- * @param subdevice:  
- * @param excl:  
- * @return int: A negative error code is returned on failure.
+ * @brief Select a subdevice, optionally for exclusive access.
+ * An exclusively selected subdevice can only be accessed through this file, other files get -EBUSY.
+ * The ownership ends when the file selects another subdevice or is closed.
+ * @param f: The file selecting the subdevice.
+ * @param subdevice: Id of the subdevice.
+ * @param excl: Select the subdevice exclusively.
+ * @return int: A negative error code is returned on failure, -EBUSY if another file owns the subdevice.
  */
 int flink_select_subdevice(struct file* f, u8 subdevice, bool excl) {
 	struct flink_private_data* pdata = (struct flink_private_data*)(f->private_data);
 	if(pdata != NULL && pdata->fdev != NULL) {
 		struct flink_device* fdev = pdata->fdev;
-		pdata->current_subdevice = flink_get_subdevice_by_id(fdev, subdevice);
-		// TODO exclusive access
+		struct flink_subdevice* subdev;
+		if(flink_subdevice_bound_elsewhere(pdata, subdevice)) {
+			return -EPERM;
+		}
+		subdev = flink_get_subdevice_by_id(fdev, subdevice);
 		#if defined(DBG)
 			printk(KERN_DEBUG "[%s] Selecting subdevice %u", MODULE_NAME, subdevice);
 			if(excl) printk(KERN_DEBUG "  -> exclusive");
 			else printk(KERN_DEBUG "  -> not exclusive");
 		#endif
+		if(pdata->excl_subdevice != NULL && (pdata->excl_subdevice != subdev || !excl)) {
+			flink_release_subdevice(pdata);
+		}
+		if(excl && pdata->excl_subdevice == NULL) {
+			if(subdev == NULL) {
+				return -EINVAL;
+			}
+			if(cmpxchg(&(subdev->excl_owner), NULL, pdata) != NULL) {
+				#if defined(DBG)
+					printk(KERN_DEBUG "  -> subdevice is owned by another file");
+				#endif
+				return -EBUSY;
+			}
+			// existing mappings bypass the ownership check, see flink_mmap()
+			if(atomic_read(&(subdev->nof_mappings)) > 0) {
+				cmpxchg(&(subdev->excl_owner), pdata, NULL);
+				#if defined(DBG)
+					printk(KERN_DEBUG "  -> subdevice is memory mapped");
+				#endif
+				return -EBUSY;
+			}
+			pdata->excl_subdevice = subdev;
+		}
+		pdata->current_subdevice = subdev;
 		return 0;
 	}
 	return UNKOWN_ERROR;
@@ -1454,6 +4992,7 @@ EXPORT_SYMBOL(flink_device_init_irq);
 EXPORT_SYMBOL(flink_device_add);
 EXPORT_SYMBOL(flink_device_remove);
 EXPORT_SYMBOL(flink_device_delete);
+EXPORT_SYMBOL(flink_device_put);
 EXPORT_SYMBOL(flink_get_device_by_id);
 EXPORT_SYMBOL(flink_get_device_list);
 EXPORT_SYMBOL(flink_subdevice_alloc);
@@ -1462,5 +5001,7 @@ EXPORT_SYMBOL(flink_subdevice_add);
 EXPORT_SYMBOL(flink_subdevice_remove);
 EXPORT_SYMBOL(flink_subdevice_delete);
 EXPORT_SYMBOL(flink_get_subdevice_by_id);
+EXPORT_SYMBOL(flink_get_subdevice_by_function);
+EXPORT_SYMBOL(flink_get_subdevice_by_unique_id);
 EXPORT_SYMBOL(flink_select_subdevice);
 EXPORT_SYMBOL(flink_get_sysfs_class);
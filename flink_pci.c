@@ -118,6 +118,82 @@ u32 pci_address_space_size(struct flink_device* fdev) {
 	return 0;
 }
 
+u32 pci_read32_relaxed(struct flink_device* fdev, u32 addr) {
+	struct flink_pci_data* pci_data = (struct flink_pci_data*)fdev->bus_data;
+	if(pci_data != NULL) {
+		return readl_relaxed(pci_data->base_addr + addr);
+	}
+	return 0;
+}
+
+int pci_write32_relaxed(struct flink_device* fdev, u32 addr, u32 val) {
+	struct flink_pci_data* pci_data = (struct flink_pci_data*)fdev->bus_data;
+	if(pci_data != NULL) {
+		writel_relaxed(val, pci_data->base_addr + addr);
+		return 0;
+	}
+	return -1;
+}
+
+int pci_flush(struct flink_device* fdev) {
+	struct flink_pci_data* pci_data = (struct flink_pci_data*)fdev->bus_data;
+	if(pci_data != NULL) {
+		// PCI writes are posted, a read from the device pushes them out.
+		// Address 0 is the header of the first subdevice, reading it has no side effects.
+		wmb();
+		ioread32(pci_data->base_addr);
+		return 0;
+	}
+	return -1;
+}
+
+int pci_read_block(struct flink_device* fdev, u32 addr, u32* buf, u32 count, u32 mode) {
+	struct flink_pci_data* pci_data = (struct flink_pci_data*)fdev->bus_data;
+	void __iomem* reg;
+	u32 i;
+	if(pci_data != NULL) {
+		if(mode == FLINK_BLOCK_FIXED) {
+			ioread32_rep(pci_data->base_addr + addr, buf, count);
+		}
+		else {
+			for(i = 0; i < count; i++) {
+				reg = pci_data->base_addr + addr + ((mode & FLINK_BLOCK_FIXED) ? 0 : i * sizeof(u32));
+				buf[i] = (mode & FLINK_BLOCK_RELAXED) ? readl_relaxed(reg) : ioread32(reg);
+			}
+		}
+		return 0;
+	}
+	return -1;
+}
+
+int pci_write_block(struct flink_device* fdev, u32 addr, const u32* buf, u32 count, u32 mode) {
+	struct flink_pci_data* pci_data = (struct flink_pci_data*)fdev->bus_data;
+	void __iomem* reg;
+	u32 i;
+	if(pci_data != NULL) {
+		if(mode == FLINK_BLOCK_FIXED) {
+			iowrite32_rep(pci_data->base_addr + addr, buf, count);
+		}
+		else {
+			for(i = 0; i < count; i++) {
+				reg = pci_data->base_addr + addr + ((mode & FLINK_BLOCK_FIXED) ? 0 : i * sizeof(u32));
+				if(mode & FLINK_BLOCK_RELAXED) writel_relaxed(buf[i], reg);
+				else iowrite32(buf[i], reg);
+			}
+		}
+		return 0;
+	}
+	return -1;
+}
+
+phys_addr_t pci_phys_address(struct flink_device* fdev) {
+	struct flink_pci_data* pci_data = (struct flink_pci_data*)fdev->bus_data;
+	if(pci_data != NULL) {
+		return pci_resource_start(pci_data->pci_device, BAR_0) + BASE_OFFSET;
+	}
+	return 0;
+}
+
 struct flink_bus_ops pci_bus_ops = {
 	.read8              = pci_read8,
 	.read16             = pci_read16,
@@ -125,7 +201,14 @@ struct flink_bus_ops pci_bus_ops = {
 	.write8             = pci_write8,
 	.write16            = pci_write16,
 	.write32            = pci_write32,
-	.address_space_size = pci_address_space_size
+	.address_space_size = pci_address_space_size,
+	.phys_address       = pci_phys_address,
+	.read_block         = pci_read_block,
+	.write_block        = pci_write_block,
+	.read32_relaxed     = pci_read32_relaxed,
+	.write32_relaxed    = pci_write32_relaxed,
+	.flush              = pci_flush,
+	.caps               = FLINK_CAP_8BIT | FLINK_CAP_16BIT | FLINK_CAP_32BIT | FLINK_CAP_BURST | FLINK_CAP_RELAXED | FLINK_CAP_MMAP | FLINK_CAP_ATOMIC
 };
 
 // ############ Device handling ############
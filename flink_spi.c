@@ -46,15 +46,15 @@ MODULE_ALIAS("spi:flink_spi");
 
 /// @brief SPI bus data
 struct spi_data {
-	spinlock_t			spi_lock;
+	struct mutex		bus_lock;	// serializes all transfers of the device, protects the fields below
 	struct spi_device*	spi;
 	u32*				txBuf;	// byte ordering in memory is platform specific
 	u32*				rxBuf;
+	struct spi_transfer	t1, t2, r1;
+	struct spi_message	m1, m2;
 	unsigned long 		mem_size; // memory size of flink device including all subdevices
 };
 
-struct spi_transfer	t1 = {.len = 4,}, t2 = {.len = 4,}, r1 = {.len = 4,};
-struct spi_message m1,m2;
 static LIST_HEAD(device_list);
 
 // ############ Bus communication functions ############
@@ -71,17 +71,23 @@ u16 spi_read16(struct flink_device* fdev, u32 addr) {
 u32 spi_read32(struct flink_device* fdev, u32 addr) {
 	ssize_t	status = 0;
 	struct spi_data* data = (struct spi_data*)fdev->bus_data;
-	u32 val;
-	spi_message_init(&m1);
-	spi_message_init(&m2);
-	t1.tx_buf = data->txBuf;
+	u32 val = 0;
+	mutex_lock(&data->bus_lock);
+	if(data->spi == NULL) {
+		mutex_unlock(&data->bus_lock);
+		return 0;
+	}
+	spi_message_init(&data->m1);
+	spi_message_init(&data->m2);
+	data->t1.tx_buf = data->txBuf;
 	*data->txBuf = addr;
-	r1.rx_buf = data->rxBuf;
-	spi_message_add_tail(&t1, &m1);
-	spi_message_add_tail(&r1, &m2);
-	status = spi_sync(data->spi, &m1);
-	status = spi_sync(data->spi, &m2);
+	data->r1.rx_buf = data->rxBuf;
+	spi_message_add_tail(&data->t1, &data->m1);
+	spi_message_add_tail(&data->r1, &data->m2);
+	status = spi_sync(data->spi, &data->m1);
+	status = spi_sync(data->spi, &data->m2);
 	val = *data->rxBuf;
+	mutex_unlock(&data->bus_lock);
 //	printk(KERN_DEBUG "[%s] read from addr: 0x%x\n", MODULE_NAME, (u32)*data->txBuf);
 //	printk(KERN_DEBUG "[%s] read: 0x%x\n", MODULE_NAME, val);
 	return val;
@@ -100,21 +106,104 @@ int spi_write16(struct flink_device* fdev, u32 addr, u16 val) {
 int spi_write32(struct flink_device* fdev, u32 addr, u32 val) {
 	ssize_t	status = 0;
 	struct spi_data* data = (struct spi_data*)fdev->bus_data;
-	spi_message_init(&m1);
-	spi_message_init(&m2);
-	t1.tx_buf = data->txBuf;
+	mutex_lock(&data->bus_lock);
+	if(data->spi == NULL) {
+		mutex_unlock(&data->bus_lock);
+		return -ENODEV;
+	}
+	spi_message_init(&data->m1);
+	spi_message_init(&data->m2);
+	data->t1.tx_buf = data->txBuf;
 	*data->txBuf = addr | 0x80000000;	// set write bit
-	t2.tx_buf = data->txBuf + 1;
+	data->t2.tx_buf = data->txBuf + 1;
 	*(data->txBuf + 1) = val;
-	spi_message_add_tail(&t1, &m1);
-	spi_message_add_tail(&t2, &m2);
-	status = spi_sync(data->spi, &m1);
-	status = spi_sync(data->spi, &m2);
+	spi_message_add_tail(&data->t1, &data->m1);
+	spi_message_add_tail(&data->t2, &data->m2);
+	status = spi_sync(data->spi, &data->m1);
+	status = spi_sync(data->spi, &data->m2);
+	mutex_unlock(&data->bus_lock);
 //	printk(KERN_DEBUG "[%s] write to addr: 0x%x\n", MODULE_NAME, *data->txBuf);
 //	printk(KERN_DEBUG "[%s] write: 0x%x\n", MODULE_NAME, *(data->txBuf+1));
 	return 0;
 }
 
+/**
+ * spi_read_block() - reads a block of registers with one spi message
+ *
+ * Every register is read with an address frame followed by a data frame,
+ * like in spi_read32(). The chip select is toggled between the frames, but
+ * the whole block is transferred with a single call to spi_sync().
+ */
+int spi_read_block(struct flink_device* fdev, u32 addr, u32* buf, u32 count, u32 mode) {
+	struct spi_data* data = (struct spi_data*)fdev->bus_data;
+	struct spi_transfer* t;
+	struct spi_message m;
+	u32* tx;
+	u32* rx;
+	u32 i;
+	int status = -ENOMEM;
+	
+	if(count == 0) return 0;
+	t = kcalloc(2 * count, sizeof(*t), GFP_KERNEL);
+	tx = kmalloc_array(count, sizeof(u32), GFP_KERNEL);	// DMA safe buffers
+	rx = kmalloc_array(count, sizeof(u32), GFP_KERNEL);
+	if(t != NULL && tx != NULL && rx != NULL) {
+		for(i = 0; i < count; i++) {
+			tx[i] = (mode & FLINK_BLOCK_FIXED) ? addr : addr + i * sizeof(u32);
+			t[2 * i].tx_buf = &tx[i];
+			t[2 * i].len = 4;
+			t[2 * i].cs_change = 1;
+			t[2 * i + 1].rx_buf = &rx[i];
+			t[2 * i + 1].len = 4;
+			t[2 * i + 1].cs_change = (i < count - 1);
+		}
+		spi_message_init_with_transfers(&m, t, 2 * count);
+		mutex_lock(&data->bus_lock);
+		status = (data->spi != NULL) ? spi_sync(data->spi, &m) : -ENODEV;
+		mutex_unlock(&data->bus_lock);
+		if(status == 0) memcpy(buf, rx, count * sizeof(u32));
+	}
+	kfree(t);
+	kfree(tx);
+	kfree(rx);
+	return status;
+}
+
+/**
+ * spi_write_block() - writes a block of registers with one spi message
+ */
+int spi_write_block(struct flink_device* fdev, u32 addr, const u32* buf, u32 count, u32 mode) {
+	struct spi_data* data = (struct spi_data*)fdev->bus_data;
+	struct spi_transfer* t;
+	struct spi_message m;
+	u32* tx;
+	u32 i;
+	int status = -ENOMEM;
+	
+	if(count == 0) return 0;
+	t = kcalloc(2 * count, sizeof(*t), GFP_KERNEL);
+	tx = kmalloc_array(2 * count, sizeof(u32), GFP_KERNEL);
+	if(t != NULL && tx != NULL) {
+		for(i = 0; i < count; i++) {
+			tx[2 * i] = ((mode & FLINK_BLOCK_FIXED) ? addr : addr + i * sizeof(u32)) | 0x80000000;	// set write bit
+			tx[2 * i + 1] = buf[i];
+			t[2 * i].tx_buf = &tx[2 * i];
+			t[2 * i].len = 4;
+			t[2 * i].cs_change = 1;
+			t[2 * i + 1].tx_buf = &tx[2 * i + 1];
+			t[2 * i + 1].len = 4;
+			t[2 * i + 1].cs_change = (i < count - 1);
+		}
+		spi_message_init_with_transfers(&m, t, 2 * count);
+		mutex_lock(&data->bus_lock);
+		status = (data->spi != NULL) ? spi_sync(data->spi, &m) : -ENODEV;
+		mutex_unlock(&data->bus_lock);
+	}
+	kfree(t);
+	kfree(tx);
+	return status;
+}
+
 u32 spi_address_space_size(struct flink_device* fdev) {
 	struct spi_data* data = (struct spi_data*)fdev->bus_data;
 	return (u32)(data->mem_size);
@@ -127,7 +216,10 @@ struct flink_bus_ops spi_bus_ops = {
 	.write8             = spi_write8,
 	.write16            = spi_write16,
 	.write32            = spi_write32,
-	.address_space_size = spi_address_space_size
+	.address_space_size = spi_address_space_size,
+	.read_block         = spi_read_block,
+	.write_block        = spi_write_block,
+	.caps               = FLINK_CAP_32BIT | FLINK_CAP_BURST
 };
 
 // ############ Driver probe and release functions ############
@@ -143,7 +235,10 @@ static int flink_spi_probe(struct spi_device *spi) {
 	if (!spiData) return -ENOMEM;
 	// Initialize the driver data
 	spiData->spi = spi;
-	spin_lock_init(&spiData->spi_lock);
+	mutex_init(&spiData->bus_lock);
+	spiData->t1.len = 4;
+	spiData->t2.len = 4;
+	spiData->r1.len = 4;
 
 	spi_set_drvdata(spi, spiData);
 
@@ -180,10 +275,10 @@ static int flink_spi_remove(struct spi_device *spi) {
 	}
 
 	/* make sure ops on existing fds can abort cleanly */
-	spin_lock_irq(&spiData->spi_lock);
+	mutex_lock(&spiData->bus_lock);
 	spiData->spi = NULL;
 	spi_set_drvdata(spi, NULL);
-	spin_unlock_irq(&spiData->spi_lock);
+	mutex_unlock(&spiData->bus_lock);
 	kfree(spiData->txBuf);
 	kfree(spiData->rxBuf);
 	kfree(spiData);
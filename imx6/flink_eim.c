@@ -31,6 +31,7 @@
 #include <linux/platform_device.h>
 #include <linux/of_device.h>
 #include <linux/of_address.h>
+#include <linux/spinlock.h>
 
 #include "../flink.h"
 #include "../flink_debug.h"
@@ -57,6 +58,12 @@ static int flink_eim_write8(struct flink_device* fdev, u32 addr, u8 val);
 static int flink_eim_write16(struct flink_device* fdev, u32 addr, u16 val);
 static int flink_eim_write32(struct flink_device* fdev, u32 addr, u32 val);
 static u32 flink_eim_address_space_size(struct flink_device* fdev);
+static phys_addr_t flink_eim_phys_address(struct flink_device* fdev);
+static int flink_eim_read_block(struct flink_device* fdev, u32 addr, u32* buf, u32 count, u32 mode);
+static int flink_eim_write_block(struct flink_device* fdev, u32 addr, const u32* buf, u32 count, u32 mode);
+static u32 flink_eim_read32_relaxed(struct flink_device* fdev, u32 addr);
+static int flink_eim_write32_relaxed(struct flink_device* fdev, u32 addr, u32 val);
+static int flink_eim_flush(struct flink_device* fdev);
 
 
 
@@ -94,11 +101,19 @@ struct flink_bus_ops flink_eim_bus_ops =
 	.write8             = flink_eim_write8,
 	.write16            = flink_eim_write16,
 	.write32            = flink_eim_write32,
-	.address_space_size = flink_eim_address_space_size
+	.address_space_size = flink_eim_address_space_size,
+	.phys_address       = flink_eim_phys_address,
+	.read_block         = flink_eim_read_block,
+	.write_block        = flink_eim_write_block,
+	.read32_relaxed     = flink_eim_read32_relaxed,
+	.write32_relaxed    = flink_eim_write32_relaxed,
+	.flush              = flink_eim_flush,
+	.caps               = FLINK_CAP_8BIT | FLINK_CAP_16BIT | FLINK_CAP_32BIT | FLINK_CAP_BURST | FLINK_CAP_RELAXED | FLINK_CAP_MMAP | FLINK_CAP_ATOMIC
 };
 
 struct flink_eim_bus_data
 {
+	spinlock_t rmw_lock;	// 8 and 16 bit writes modify the whole 32 bit word
 	void __iomem *base;
 	resource_size_t start;
 	resource_size_t size;
@@ -182,6 +197,7 @@ static int flink_eim_probe(struct platform_device *pdev)
 		goto ressource_failure;
 	}
 
+	spin_lock_init(&bus_data->rmw_lock);
 	bus_data->start = res.start;
 	bus_data->size = resource_size(&res);
 
@@ -280,8 +296,11 @@ static int flink_eim_write8(struct flink_device* fdev, u32 addr, u8 val)
 {
 	struct flink_eim_bus_data* d = (struct flink_eim_bus_data*)fdev->bus_data;
 	if (d != NULL) {
-		u32 v = ((flink_eim_read32(fdev, addr) & 0xff000000) | val);
+		u32 v;
+		spin_lock(&d->rmw_lock);
+		v = ((flink_eim_read32(fdev, addr) & 0xff000000) | val);
 		iowrite32(v, d->base + addr);
+		spin_unlock(&d->rmw_lock);
 	}
 	return 0;
 }
@@ -290,8 +309,11 @@ static int flink_eim_write16(struct flink_device* fdev, u32 addr, u16 val)
 {
 	struct flink_eim_bus_data* d = (struct flink_eim_bus_data*)fdev->bus_data;
 	if (d != NULL) {
-		u32 v = ((flink_eim_read32(fdev, addr) & 0xffff0000) | val);
+		u32 v;
+		spin_lock(&d->rmw_lock);
+		v = ((flink_eim_read32(fdev, addr) & 0xffff0000) | val);
 		iowrite32(v, d->base + addr);
+		spin_unlock(&d->rmw_lock);
 	}
 	return 0;
 }
@@ -305,12 +327,87 @@ static int flink_eim_write32(struct flink_device* fdev, u32 addr, u32 val)
 	return 0;
 }
 
+static int flink_eim_read_block(struct flink_device* fdev, u32 addr, u32* buf, u32 count, u32 mode)
+{
+	struct flink_eim_bus_data* d = (struct flink_eim_bus_data*)fdev->bus_data;
+	void __iomem* reg;
+	u32 i;
+	if (d == NULL) {
+		return -ENODEV;
+	}
+	if (mode == FLINK_BLOCK_FIXED) {
+		ioread32_rep(d->base + addr, buf, count);
+	} else {
+		for (i = 0; i < count; i++) {
+			reg = d->base + addr + ((mode & FLINK_BLOCK_FIXED) ? 0 : i * sizeof(u32));
+			buf[i] = (mode & FLINK_BLOCK_RELAXED) ? readl_relaxed(reg) : ioread32(reg);
+		}
+	}
+	return 0;
+}
+
+static int flink_eim_write_block(struct flink_device* fdev, u32 addr, const u32* buf, u32 count, u32 mode)
+{
+	struct flink_eim_bus_data* d = (struct flink_eim_bus_data*)fdev->bus_data;
+	void __iomem* reg;
+	u32 i;
+	if (d == NULL) {
+		return -ENODEV;
+	}
+	if (mode == FLINK_BLOCK_FIXED) {
+		iowrite32_rep(d->base + addr, buf, count);
+	} else {
+		for (i = 0; i < count; i++) {
+			reg = d->base + addr + ((mode & FLINK_BLOCK_FIXED) ? 0 : i * sizeof(u32));
+			if (mode & FLINK_BLOCK_RELAXED) writel_relaxed(buf[i], reg);
+			else iowrite32(buf[i], reg);
+		}
+	}
+	return 0;
+}
+
+static u32 flink_eim_read32_relaxed(struct flink_device* fdev, u32 addr)
+{
+	struct flink_eim_bus_data* d = (struct flink_eim_bus_data*)fdev->bus_data;
+	if (d != NULL) {
+		return readl_relaxed(d->base + addr);
+	}
+	return 0;
+}
+
+static int flink_eim_write32_relaxed(struct flink_device* fdev, u32 addr, u32 val)
+{
+	struct flink_eim_bus_data* d = (struct flink_eim_bus_data*)fdev->bus_data;
+	if (d != NULL) {
+		writel_relaxed(val, d->base + addr);
+	}
+	return 0;
+}
+
+static int flink_eim_flush(struct flink_device* fdev)
+{
+	struct flink_eim_bus_data* d = (struct flink_eim_bus_data*)fdev->bus_data;
+	if (d == NULL) {
+		return -ENODEV;
+	}
+	// order all previous accesses and wait for the write buffer to drain
+	wmb();
+	ioread32(d->base);
+	return 0;
+}
+
 static u32 flink_eim_address_space_size(struct flink_device* fdev)
 {
 	struct flink_eim_bus_data* d = (struct flink_eim_bus_data*)fdev->bus_data;
 	return (u32)(d->size);
 }
 
+static phys_addr_t flink_eim_phys_address(struct flink_device* fdev)
+{
+	struct flink_eim_bus_data* d = (struct flink_eim_bus_data*)fdev->bus_data;
+	return (phys_addr_t)(d->start);
+}
+
 
 
 // ####### module infos ########################################################
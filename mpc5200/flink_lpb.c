@@ -129,6 +129,11 @@ u32 lpb_address_space_size(struct flink_device* fdev) {
 	return (u32)(lpb_data->mem_size);
 }
 
+phys_addr_t lpb_phys_address(struct flink_device* fdev) {
+	struct flink_lpb_data* lpb_data = (struct flink_lpb_data*)fdev->bus_data;
+	return (phys_addr_t)(lpb_data->base_address);
+}
+
 struct flink_bus_ops lpb_bus_ops = {
 	.read8              = lpb_read8,
 	.read16             = lpb_read16,
@@ -136,7 +141,8 @@ struct flink_bus_ops lpb_bus_ops = {
 	.write8             = lpb_write8,
 	.write16            = lpb_write16,
 	.write32            = lpb_write32,
-	.address_space_size = lpb_address_space_size
+	.address_space_size = lpb_address_space_size,
+	.phys_address       = lpb_phys_address
 };
 
 // search for compatible node in device tree, returns node
@@ -70,6 +70,12 @@ static int flink_axi_write8(struct flink_device* fdev, u32 addr, u8 val);
 static int flink_axi_write16(struct flink_device* fdev, u32 addr, u16 val);
 static int flink_axi_write32(struct flink_device* fdev, u32 addr, u32 val);
 static u32 flink_axi_address_space_size(struct flink_device* fdev);
+static phys_addr_t flink_axi_phys_address(struct flink_device* fdev);
+static int flink_axi_read_block(struct flink_device* fdev, u32 addr, u32* buf, u32 count, u32 mode);
+static int flink_axi_write_block(struct flink_device* fdev, u32 addr, const u32* buf, u32 count, u32 mode);
+static u32 flink_axi_read32_relaxed(struct flink_device* fdev, u32 addr);
+static int flink_axi_write32_relaxed(struct flink_device* fdev, u32 addr, u32 val);
+static int flink_axi_flush(struct flink_device* fdev);
 
 static int flink_axi_probe(struct platform_device *pdev);
 static int flink_axi_remove(struct platform_device *pdev);
@@ -121,7 +127,14 @@ struct flink_bus_ops flink_axi_bus_ops =
 	.write8             = flink_axi_write8,
 	.write16            = flink_axi_write16,
 	.write32            = flink_axi_write32,
-	.address_space_size = flink_axi_address_space_size
+	.address_space_size = flink_axi_address_space_size,
+	.phys_address       = flink_axi_phys_address,
+	.read_block         = flink_axi_read_block,
+	.write_block        = flink_axi_write_block,
+	.read32_relaxed     = flink_axi_read32_relaxed,
+	.write32_relaxed    = flink_axi_write32_relaxed,
+	.flush              = flink_axi_flush,
+	.caps               = FLINK_CAP_8BIT | FLINK_CAP_16BIT | FLINK_CAP_32BIT | FLINK_CAP_BURST | FLINK_CAP_RELAXED | FLINK_CAP_MMAP | FLINK_CAP_ATOMIC
 };
 
 // ############ Module Bus Operations ############
@@ -189,11 +202,90 @@ static int flink_axi_write32(struct flink_device* fdev, u32 addr, u32 val) {
 	return 0;
 }
 
+static inline u8 flink_check_block(struct flink_axi_bus_data* d, u32 offset, u32 count, u32 mode) {
+	u32 size = (mode & FLINK_BLOCK_FIXED) ? sizeof(u32) : count * sizeof(u32);
+	return count > 0 && offset < d->size && size <= d->size - offset;
+}
+
+static int flink_axi_read_block(struct flink_device* fdev, u32 addr, u32* buf, u32 count, u32 mode) {
+    struct flink_axi_bus_data* d = (struct flink_axi_bus_data*)fdev->bus_data;
+	void __iomem* reg;
+	u32 i;
+	if (likely(d != NULL && flink_check_block(d, addr, count, mode))) {
+		if (mode == FLINK_BLOCK_FIXED) {
+			ioread32_rep(d->base + addr, buf, count);
+		} else {
+			for (i = 0; i < count; i++) {
+				reg = d->base + addr + ((mode & FLINK_BLOCK_FIXED) ? 0 : i * sizeof(u32));
+				buf[i] = (mode & FLINK_BLOCK_RELAXED) ? readl_relaxed(reg) : ioread32(reg);
+			}
+		}
+		return 0;
+	}
+	printk(KERN_ERR "[%s] Failed to perform the block read operation\n", MODULE_NAME);
+	return -EINVAL;
+}
+
+static int flink_axi_write_block(struct flink_device* fdev, u32 addr, const u32* buf, u32 count, u32 mode) {
+    struct flink_axi_bus_data* d = (struct flink_axi_bus_data*)fdev->bus_data;
+	void __iomem* reg;
+	u32 i;
+	if (likely(d != NULL && flink_check_block(d, addr, count, mode))) {
+		if (mode == FLINK_BLOCK_FIXED) {
+			iowrite32_rep(d->base + addr, buf, count);
+		} else {
+			for (i = 0; i < count; i++) {
+				reg = d->base + addr + ((mode & FLINK_BLOCK_FIXED) ? 0 : i * sizeof(u32));
+				if (mode & FLINK_BLOCK_RELAXED) writel_relaxed(buf[i], reg);
+				else iowrite32(buf[i], reg);
+			}
+		}
+		return 0;
+	}
+	printk(KERN_ERR "[%s] Failed to perform the block write operation\n", MODULE_NAME);
+	return -EINVAL;
+}
+
+static u32 flink_axi_read32_relaxed(struct flink_device* fdev, u32 addr) {
+    struct flink_axi_bus_data* d = (struct flink_axi_bus_data*)fdev->bus_data;
+	if (likely(d != NULL && flink_check_offset(d,addr))) {
+		return readl_relaxed(d->base + addr);
+	}
+	printk(KERN_ERR "[%s] Failed to perform the readl_relaxed operation\n", MODULE_NAME);
+	return 0;
+}
+
+static int flink_axi_write32_relaxed(struct flink_device* fdev, u32 addr, u32 val) {
+    struct flink_axi_bus_data* d = (struct flink_axi_bus_data*)fdev->bus_data;
+	if (likely(d != NULL && flink_check_offset(d,addr))) {
+		writel_relaxed(val, d->base + addr);
+		return 0;
+	}
+	printk(KERN_ERR "[%s] Failed to perform the writel_relaxed operation\n", MODULE_NAME);
+	return -EINVAL;
+}
+
+static int flink_axi_flush(struct flink_device* fdev) {
+    struct flink_axi_bus_data* d = (struct flink_axi_bus_data*)fdev->bus_data;
+	if (likely(d != NULL)) {
+		// order all previous accesses, the read completes the buffered writes on the interconnect
+		wmb();
+		ioread32(d->base);
+		return 0;
+	}
+	return -ENODEV;
+}
+
 static u32 flink_axi_address_space_size(struct flink_device* fdev) {
     struct flink_axi_bus_data* d = (struct flink_axi_bus_data*)fdev->bus_data;
 	return (u32)(d->size);
 }
 
+static phys_addr_t flink_axi_phys_address(struct flink_device* fdev) {
+    struct flink_axi_bus_data* d = (struct flink_axi_bus_data*)fdev->bus_data;
+	return (phys_addr_t)(d->hardwareAddressBase);
+}
+
 // ############ Platform Driver Probe And Remove ############
 static int flink_axi_probe(struct platform_device *pdev)
 {